@@ -1,16 +1,54 @@
+#define _POSIX_C_SOURCE 200809L // õ pread/ftruncate/fileno-std=c11 Ҳ
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdbool.h>
 #include <math.h>
+#include <stddef.h>
+#if defined(_WIN32) && !defined(CACHE_NO_MMAP)
+#define CACHE_NO_MMAP           // Windows ½Ϊڴ
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <sys/locking.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#ifndef CACHE_NO_MMAP
+#include <sys/mman.h>
+#endif
+#endif
 
 // ==================== Ͷ ====================
-#define MAX_CUSTOMERS 1000
-#define MAX_WINDOWS 20
+#ifndef MAX_CUSTOMERS
+#define MAX_CUSTOMERS 1000      // ʱ߸س -DMAX_CUSTOMERS=4000 
+#endif
+#ifndef MAX_WINDOWS
+#define MAX_WINDOWS 20          //  -DMAX_WINDOWS=4096 
+#endif
+#define MAX_BUSINESS_TYPES 64   // ҵޣλ
+#define WINDOW_WORDS ((MAX_WINDOWS + 63) / 64)  // λͼ
+#if WINDOW_WORDS > 64
+#error "MAX_WINDOWS ܳ 4096λͼ"
+#endif
 #define MAX_QUEUE_SIZE 1000
 #define LOG_FILE_NAME "bank_simulation.log"
 
+// 룺 b λʾɰ b ҵ
+typedef unsigned long long SkillMask;
+#define ALL_SKILLS(n) ((n) >= 64 ? ~0ULL : ((1ULL << (n)) - 1))
+
+// ݶȹƣIPAĲ±
+#define GRAD_SERVICE_RATE 0     // Է
+#define GRAD_ARRIVAL_RATE 1     // Ե
+#define GRAD_PARAMS 2
+#define GRADIENT_BATCHES 10     // ֵ
+#define WAIT_HIST_BINS 32       // ȴʱֱͼ
+#define WAIT_HIST_WIDTH 1.0     // ÿȣӣĩĵȴ
+
 // ӡָ
 void print_separator(int length, char ch) {
     for (int i = 0; i < length; i++) {
@@ -31,6 +69,7 @@ void fprint_separator(FILE* file, int length, char ch) {
 typedef struct {
     int id;                 // ͻ
     int type;               // ҵ: 0-ͨ, 1-
+    int business;           // ҵ: 0 ~ business_types-1
     int vip_level;          // VIPȼ: 0-ͨ, 1-, 2-, 3-ʯ
     double arrival_time;    // ʱ
     double service_time;    // Ԥʱ
@@ -38,11 +77,21 @@ typedef struct {
     double finish_time;     // ʱ
     double waiting_time;    // ȴʱ
     int served_by;          // 񴰿ڱ
+    double patience;        // ʱ䣨Ŷӳʱ뿪0ʾޣ
+    int abandoned;          // ʧ: 0-δʧ, 1-ܾŶ, 2-;뿪
+    double arrival_grad[GRAD_PARAMS]; // ʱԸĵ
+    double service_grad[GRAD_PARAMS]; // ʱԸĵ
+    double wait_grad[GRAD_PARAMS];    // ȴʱԸĵ
 } Customer;
 
+#define ABANDON_NONE   0
+#define ABANDON_BALK   1    // ʱֱ뿪
+#define ABANDON_RENEGE 2    // Ŷӵȴʱ뿪
+
 // ڽṹ
 typedef struct {
     int id;                 // ڱ
+    SkillMask skills;       // ɰҵ
     bool is_open;           // Ƿ񿪷
     bool is_busy;           // Ƿæµ
     Customer current_customer; // ǰĿͻ
@@ -50,12 +99,15 @@ typedef struct {
     double busy_end;        // æµʱ
     double total_busy_time; // æµʱ
     double total_idle_time; // ܿʱ
+    double idle_start;      // οпʼʱ䣨нʱܿʱ䣩
     int served_count;       // ѷͻ
+    double finish_grad[GRAD_PARAMS]; // ǰʱԸĵ
 } Window;
 
 // нڵ
 typedef struct Node {
     Customer customer;
+    struct Node* prev;
     struct Node* next;
 } Node;
 
@@ -77,6 +129,11 @@ typedef struct {
     double priority_ratio;  // ҵ
     int simulation_time;    // ʱ
     int customer_count;     // ͻ
+    int business_types;     // ҵ (1-MAX_BUSINESS_TYPES)
+    int balk_threshold;     // ܾŶֵŶ0ʾã
+    double mean_patience;   // ƽʱ䣨ӣ0ʾ;뿪
+    double arrival_rate;    // ʣͻ/ӣ
+    double service_rate;    // ʣֲָ
 } SimulationParams;
 
 // ͳƽṹ
@@ -89,20 +146,276 @@ typedef struct {
     double throughput;          // ϵͳͻ/ӣ
     double total_wait_time[2];  // ܵȴʱ
     int served_count[2];        // ͻ
+    int business_served[MAX_BUSINESS_TYPES];       // ҵͻ
+    double business_wait_time[MAX_BUSINESS_TYPES]; // ҵܵȴʱ
+    int arrived_count[2];       // ѵͻ
+    int balked_count[2];        // ܾŶӿͻ
+    int reneged_count[2];       // ;뿪ͻ
+    double abandon_rate[2];     // ʧʣ%
+    double wait_grad[2][GRAD_PARAMS];       // ƽȴʱԸĵ
+    double wait_grad_half[2][GRAD_PARAMS];  // 95%
+    int wait_histogram[2][WAIT_HIST_BINS];  // ѷͻĵȴʱֲ
+    int max_waiting;            // Ŷÿ¼ƣ
 } Statistics;
 
+// ¼ͣ¼ժҪ켣¼
+#define EVENT_ARRIVAL 0         // ͻ
+#define EVENT_START   1         // ʼ
+#define EVENT_FINISH  2         // ɷ
+#define EVENT_OPEN    3         // ڿ
+#define EVENT_CLOSE   4         // ڹر
+#define EVENT_BALK    5         // ܾŶ
+#define EVENT_RENEGE  6         // ;뿪
+
+#define MAX_TRACE_EVENTS (MAX_CUSTOMERS * 5 + 16)  // η¼
+#define TRACE_TIME_TOLERANCE 1e-9                  // 켣ȶԵʱݲ
+
+// ¼¼
+typedef struct {
+    double time;            // ¼ʱ
+    int type;               // ¼
+    int customer_id;        // ͻţΪ-1
+    int window_id;          // ڱţΪ-1
+} EventRecord;
+
+// ¼켣
+typedef struct {
+    EventRecord events[MAX_TRACE_EVENTS];
+    int count;              // Ѽ¼¼
+    unsigned long long digest; // ¼ժҪ
+} EventTrace;
+
+// ¼ѣÿɵ¼ռһ̶λλͬʱΪͬһʱ¼Ⱥ
+//  <  < ;뿪ͬ¼ͻ/ڱţ
+#define FINISH_SLOT_BASE MAX_CUSTOMERS
+#define RENEGE_SLOT_BASE (MAX_CUSTOMERS + MAX_WINDOWS)
+#define EVENT_SLOTS (MAX_CUSTOMERS * 2 + MAX_WINDOWS)
+#define ARRIVAL_SLOT(i) (i)
+#define FINISH_SLOT(w) (FINISH_SLOT_BASE + (w))
+#define RENEGE_SLOT(i) (RENEGE_SLOT_BASE + (i))
+
+typedef struct {
+    double* time;               // λ¼ʱ
+    int* heap;                  // СѣŲλ
+    int* pos;                   // λڶе±꣨-1ʾδȣ
+    int size;                   // ѵ¼
+    int capacity;               // λ
+} EventHeap;
+
+// ֲ
+#define DIST_EXPONENTIAL 0      // ֲָaΪʣ
+#define DIST_HISTOGRAM   1      // ֱͼѡ䣬ھ
+#define DIST_SAMPLES     2      // ʵȸʳȡ
+#define DIST_LOGNORMAL   3      // ̬a=mu, b=sigma
+#define DIST_GAMMA       4      // ٤a=״, b=߶ȣ
+#define DIST_PHASE_TYPE  5      // λͣErlang֧Ļ
+#define DIST_BATCH 256          // ֲÿɵ
+#define PI 3.14159265358979323846  // M_PI ڱ׼C
+#define VIP_LEVELS 4
+
+typedef struct {
+    int kind;
+    double a, b;            // ֲĲ
+    int n;                  // //֧
+    double* values;         // ֱͼ߽(n+1)ֵ(n)
+    double* prob;           // 
+    int* alias;             // ±
+    int* phases;            // λ֧ͣλ
+    double* rates;          // λ֧ͣÿ
+    double batch[DIST_BATCH]; // ɵ
+    int batch_pos;
+    int batch_len;
+    double setup_ms;        // ʱ룩
+} Distribution;
+
+// ģͣҵVIPȼķʱֲͻĵֲ
+// ΪNULLԭеֲָ
+#define MAX_MODEL_DISTS (MAX_BUSINESS_TYPES * VIP_LEVELS + 2)
+typedef struct {
+    Distribution* service[MAX_BUSINESS_TYPES][VIP_LEVELS];
+    Distribution* interarrival[2];
+    Distribution* owned[MAX_MODEL_DISTS]; // ģͳеȫֲͬһֲܱã
+    int owned_count;
+    char source[256];       // Դļڻ
+    double setup_ms;        // ȫֲĹʱ
+} WorkloadModel;
+
+// 
+#define ARRIVAL_POISSON  0      // β
+#define ARRIVAL_SCHEDULE 1      // βɣֶʱظϡ軯
+#define ARRIVAL_MMPP     2      // ɷƲɣ״̬ʲͬ״̬л
+#define MAX_RATE_KNOTS 32
+#define MAX_MMPP_STATES 4
+
+// ̰ʱֻ̣浱ǰ״̬ⳤķ
+typedef struct {
+    int kind;
+    char name[32];
+    double rate;                        // βɵʣ/ӣ
+    int knot_count;                     // ʱڵ׽ڵʱΪ0ĩڵʱ̼ڣ
+    double knot_time[MAX_RATE_KNOTS];
+    double knot_rate[MAX_RATE_KNOTS];
+    int state_count;                    // MMPP ״̬
+    double state_rate[MAX_MMPP_STATES];   // ״̬
+    double state_leave[MAX_MMPP_STATES];  // ״̬뿪ʣƽͣ 1/state_leave ӣ
+    double state_jump[MAX_MMPP_STATES][MAX_MMPP_STATES]; // 뿪ת״̬ĸ
+    double batch_mean;                  // ÿƽηֲ1ʾ
+    double scale;                       // ʱ
+    double time;                        // һĵʱ
+    double cycle_start;                 // ʱǰڵ
+    int segment;                        // ǰʶ
+    int state;                          // MMPP ǰ״̬
+    double state_end;                   // MMPP ǰ״̬ʱ
+    int batch_left;                     // δ
+    long candidates;                    // ϡ軯ĺѡ
+    long accepted;                      // ܵĺѡ
+} ArrivalProcess;
+
 // ==================== ȫֱ ====================
-Queue priority_queue;      // ȶ
-Queue normal_queue;        // ͨ
+Queue priority_queue[MAX_BUSINESS_TYPES]; // ȶУҵࣩ
+Queue normal_queue[MAX_BUSINESS_TYPES];   // ͨУҵࣩ
+Node* queue_nodes[MAX_CUSTOMERS]; // ŶпͻĶнڵ㣨ͻ±꣬O(1)Ƴ
+SkillMask waiting_mask[2]; // ǿնλͼ[0ͨ,1]
+int waiting_total;         // Ŷӿͻ
+int peak_waiting;          // ηŶֵ
 Window windows[MAX_WINDOWS]; // 
+SkillMask window_skills[MAX_WINDOWS]; // ڼã0ʾȫܴڣ
+unsigned long long idle_windows[MAX_BUSINESS_TYPES][WINDOW_WORDS]; // ҵõĿдλͼ
+unsigned long long idle_summary[MAX_BUSINESS_TYPES]; // kλʾ idle_windows[b][k] ǿ
+unsigned long long idle_any[WINDOW_WORDS];   // ȫдλͼ
+unsigned long long open_map[WINDOW_WORDS];   // Ŵλͼ
+unsigned long long skill_windows[MAX_BUSINESS_TYPES][WINDOW_WORDS]; // ҵɰĴλͼۿգ
+int open_count[MAX_BUSINESS_TYPES];          // ҵ񿪷ŵĴ
 SimulationParams params;   // 
 Statistics stats;          // ͳϢ
+EventHeap event_heap;      // ¼
 Customer customers[MAX_CUSTOMERS]; // ͻ
 int active_windows;        // ǰԾ
 double current_time;       // ǰʱ
 int next_customer_id = 1;  // һͻID
 bool log_events = true;    // Ƿ¼¼־
 FILE* log_file = NULL;     // ־ļָ
+bool print_events = true;  // ǷĻ¼
+unsigned long long event_digest; // ǰ¼ժҪ
+int event_count;           // ǰ¼
+EventTrace* event_trace = NULL; // ¼켣ΪNULLʱ¼
+bool gradient_estimation = false; // ǷͬʱIPAݶȹ
+double current_time_grad[GRAD_PARAMS]; // ǰ¼ʱԸĵ
+WorkloadModel* workload_model = NULL; // ģͣΪNULLʱʹֲָ
+double class_next_arrival[2];  // ͻһʱ
+ArrivalProcess* arrival_process = NULL; // ̣ΪNULLʱ arrival_rate ɵ
+bool arrivals_truncated = false; // һɵĿͻﵽ MAX_CUSTOMERS ĩλͻӪҵʱڵ
+
+// ==================== ¼Ѻ ====================
+// ѺԶָΪʹȫ event_heapվʹøԵĶ
+bool event_before(const EventHeap* h, int a, int b) {
+    if (h->time[a] != h->time[b]) {
+        return h->time[a] < h->time[b];
+    }
+    return a < b;
+}
+
+void heap_place(EventHeap* h, int index, int slot) {
+    h->heap[index] = slot;
+    h->pos[slot] = index;
+}
+
+void heap_sift_up(EventHeap* h, int index) {
+    int slot = h->heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!event_before(h, slot, h->heap[parent])) break;
+        heap_place(h, index, h->heap[parent]);
+        index = parent;
+    }
+    heap_place(h, index, slot);
+}
+
+void heap_sift_down(EventHeap* h, int index) {
+    int slot = h->heap[index];
+    while (true) {
+        int child = index * 2 + 1;
+        if (child >= h->size) break;
+        if (child + 1 < h->size && event_before(h, h->heap[child + 1], h->heap[child])) {
+            child++;
+        }
+        if (!event_before(h, h->heap[child], slot)) break;
+        heap_place(h, index, h->heap[child]);
+        index = child;
+    }
+    heap_place(h, index, slot);
+}
+
+void free_event_heap(EventHeap* h) {
+    free(h->time);
+    free(h->heap);
+    free(h->pos);
+    h->time = NULL;
+    h->heap = NULL;
+    h->pos = NULL;
+    h->capacity = 0;
+    h->size = 0;
+}
+
+// ¼ѣλʱ·
+void init_event_heap(EventHeap* h, int slots) {
+    if (h->capacity < slots) {
+        free_event_heap(h);
+        h->time = (double*)malloc(sizeof(double) * slots);
+        h->heap = (int*)malloc(sizeof(int) * slots);
+        h->pos = (int*)malloc(sizeof(int) * slots);
+        h->capacity = slots;
+    }
+    h->size = 0;
+    for (int i = 0; i < h->capacity; i++) {
+        h->pos[i] = -1;
+    }
+}
+
+bool is_event_scheduled(const EventHeap* h, int slot) {
+    return h->pos[slot] != -1;
+}
+
+// ¼ѵڣ
+void schedule_event(EventHeap* h, int slot, double time) {
+    h->time[slot] = time;
+    if (is_event_scheduled(h, slot)) {
+        heap_sift_up(h, h->pos[slot]);
+        heap_sift_down(h, h->pos[slot]);
+    } else {
+        h->heap[h->size] = slot;
+        h->pos[slot] = h->size;
+        h->size++;
+        heap_sift_up(h, h->size - 1);
+    }
+}
+
+// ȡ¼O(log n)
+void cancel_event(EventHeap* h, int slot) {
+    int index = h->pos[slot];
+    if (index == -1) return;
+    
+    h->pos[slot] = -1;
+    h->size--;
+    if (index < h->size) {
+        int moved = h->heap[h->size];
+        heap_place(h, index, moved);
+        heap_sift_up(h, index);
+        heap_sift_down(h, h->pos[moved]);
+    }
+}
+
+int peek_next_event(const EventHeap* h) {
+    return h->size > 0 ? h->heap[0] : -1;
+}
+
+int pop_next_event(EventHeap* h) {
+    int slot = peek_next_event(h);
+    if (slot != -1) {
+        cancel_event(h, slot);
+    }
+    return slot;
+}
 
 // ==================== в ====================
 void init_queue(Queue* q, int priority) {
@@ -115,9 +428,10 @@ bool is_queue_empty(Queue* q) {
     return q->size == 0;
 }
 
-void enqueue(Queue* q, Customer customer) {
+Node* enqueue(Queue* q, Customer customer) {
     Node* new_node = (Node*)malloc(sizeof(Node));
     new_node->customer = customer;
+    new_node->prev = q->rear;
     new_node->next = NULL;
     
     if (is_queue_empty(q)) {
@@ -127,6 +441,7 @@ void enqueue(Queue* q, Customer customer) {
         q->rear = new_node;
     }
     q->size++;
+    return new_node;
 }
 
 Customer dequeue(Queue* q) {
@@ -141,6 +456,8 @@ Customer dequeue(Queue* q) {
     
     if (q->front == NULL) {
         q->rear = NULL;
+    } else {
+        q->front->prev = NULL;
     }
     
     free(temp);
@@ -148,6 +465,26 @@ Customer dequeue(Queue* q) {
     return customer;
 }
 
+// ӶмƳָڵ
+Customer queue_remove(Queue* q, Node* node) {
+    Customer customer = node->customer;
+    
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        q->front = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        q->rear = node->prev;
+    }
+    
+    free(node);
+    q->size--;
+    return customer;
+}
+
 Customer peek_queue(Queue* q) {
     if (is_queue_empty(q)) {
         Customer empty = {0};
@@ -160,17 +497,248 @@ int queue_size(Queue* q) {
     return q->size;
 }
 
+// λ±꣨x Ϊ0
+int lowest_bit(unsigned long long x) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int i = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+void init_all_queues() {
+    for (int b = 0; b < MAX_BUSINESS_TYPES; b++) {
+        init_queue(&priority_queue[b], 1);
+        init_queue(&normal_queue[b], 0);
+    }
+    memset(queue_nodes, 0, sizeof(queue_nodes));
+    waiting_mask[0] = waiting_mask[1] = 0;
+    waiting_total = 0;
+}
+
+// ҵӣάǿնλͼ
+void enqueue_customer(Customer customer) {
+    int cls = customer.type == 1 ? 1 : 0;
+    Queue* q = cls == 1 ? &priority_queue[customer.business] : &normal_queue[customer.business];
+    queue_nodes[customer.id - 1] = enqueue(q, customer);
+    waiting_mask[cls] |= 1ULL << customer.business;
+    waiting_total++;
+}
+
+// ͻ뿪У;뿪Ĳǣάλͼȡ뿪ʱ
+void customer_left_queue(Customer customer, Queue* q) {
+    int cls = customer.type == 1 ? 1 : 0;
+    if (is_queue_empty(q)) {
+        waiting_mask[cls] &= ~(1ULL << customer.business);
+    }
+    waiting_total--;
+    queue_nodes[customer.id - 1] = NULL;
+    cancel_event(&event_heap, RENEGE_SLOT(customer.id - 1));
+}
+
+Customer dequeue_customer(int cls, int business) {
+    Queue* q = cls == 1 ? &priority_queue[business] : &normal_queue[business];
+    Customer customer = dequeue(q);
+    customer_left_queue(customer, q);
+    return customer;
+}
+
+// ŶеĿͻֱӴӶмƳO(1)
+Customer remove_waiting_customer(int index) {
+    Node* node = queue_nodes[index];
+    int business = node->customer.business;
+    Queue* q = node->customer.type == 1 ? &priority_queue[business] : &normal_queue[business];
+    Customer customer = queue_remove(q, node);
+    customer_left_queue(customer, q);
+    return customer;
+}
+
+int waiting_in_class(int cls) {
+    int total = 0;
+    SkillMask mask = waiting_mask[cls];
+    while (mask) {
+        int b = lowest_bit(mask);
+        mask &= mask - 1;
+        total += queue_size(cls == 1 ? &priority_queue[b] : &normal_queue[b]);
+    }
+    return total;
+}
+
+// ==================== ¼ժҪ ====================
+#define DIGEST_OFFSET_BASIS 14695981039346656037ULL
+#define DIGEST_PRIME 1099511628211ULL
+
+// FNV-1aһֽڲժҪ
+unsigned long long digest_bytes(unsigned long long h, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= DIGEST_PRIME;
+    }
+    return h;
+}
+
+// һ¼ʱ, , ͻ, ڣժҪ
+unsigned long long digest_event(unsigned long long h, double time, int type,
+                                int customer_id, int window_id) {
+    h = digest_bytes(h, &time, sizeof(time));
+    h = digest_bytes(h, &type, sizeof(type));
+    h = digest_bytes(h, &customer_id, sizeof(customer_id));
+    h = digest_bytes(h, &window_id, sizeof(window_id));
+    return h;
+}
+
+void trace_append(EventTrace* trace, double time, int type, int customer_id, int window_id) {
+    if (trace == NULL) return;
+    if (trace->count < MAX_TRACE_EVENTS) {
+        EventRecord* e = &trace->events[trace->count];
+        e->time = time;
+        e->type = type;
+        e->customer_id = customer_id;
+        e->window_id = window_id;
+    }
+    trace->count++;
+    trace->digest = digest_event(trace->digest, time, type, customer_id, window_id);
+}
+
+void reset_event_digest() {
+    event_digest = DIGEST_OFFSET_BASIS;
+    event_count = 0;
+    if (event_trace != NULL) {
+        event_trace->count = 0;
+        event_trace->digest = DIGEST_OFFSET_BASIS;
+    }
+}
+
+void record_event(int type, int customer_id, int window_id) {
+    event_digest = digest_event(event_digest, current_time, type, customer_id, window_id);
+    event_count++;
+    trace_append(event_trace, current_time, type, customer_id, window_id);
+}
+
+const char* event_type_name(int type) {
+    switch (type) {
+        case EVENT_ARRIVAL: return "";
+        case EVENT_START:   return "ʼ";
+        case EVENT_FINISH:  return "ɷ";
+        case EVENT_OPEN:    return "ڿ";
+        case EVENT_CLOSE:   return "ڹر";
+        case EVENT_BALK:    return "ܾŶ";
+        case EVENT_RENEGE:  return ";뿪";
+        default:            return "δ֪";
+    }
+}
+
 // ==================== ڹ ====================
+// ´ڸܿλͼе״̬ = Ҳæ
+void set_idle_bits(int window_id, bool idle) {
+    int word = window_id / 64;
+    unsigned long long bit = 1ULL << (window_id % 64);
+    SkillMask skills = windows[window_id].skills;
+    
+    if (idle) {
+        idle_any[word] |= bit;
+    } else {
+        idle_any[word] &= ~bit;
+    }
+    while (skills) {
+        int b = lowest_bit(skills);
+        skills &= skills - 1;
+        if (idle) {
+            idle_windows[b][word] |= bit;
+            idle_summary[b] |= 1ULL << word;
+        } else {
+            idle_windows[b][word] &= ~bit;
+            if (idle_windows[b][word] == 0) {
+                idle_summary[b] &= ~(1ULL << word);
+            }
+        }
+    }
+}
+
+// ڽ/뿪״̬ʱڿнʱһԼ룬¼ѭۼ
+void set_window_idle(int window_id, bool idle) {
+    if (idle) {
+        windows[window_id].idle_start = current_time;
+    } else {
+        windows[window_id].total_idle_time += current_time - windows[window_id].idle_start;
+    }
+    set_idle_bits(window_id, idle);
+}
+
+// ڿеĴڵĿʱ뵽ǰʱ
+void flush_idle_time() {
+    for (int k = 0; k < WINDOW_WORDS; k++) {
+        unsigned long long bits = idle_any[k];
+        while (bits) {
+            int i = k * 64 + lowest_bit(bits);
+            bits &= bits - 1;
+            windows[i].total_idle_time += current_time - windows[i].idle_start;
+            windows[i].idle_start = current_time;
+        }
+    }
+}
+
+// ¿Ŵλͼҵ񿪷Ŵ
+void set_window_open_bits(int window_id, bool open) {
+    SkillMask skills = windows[window_id].skills;
+    
+    if (open) {
+        open_map[window_id / 64] |= 1ULL << (window_id % 64);
+    } else {
+        open_map[window_id / 64] &= ~(1ULL << (window_id % 64));
+    }
+    while (skills) {
+        int b = lowest_bit(skills);
+        skills &= skills - 1;
+        open_count[b] += open ? 1 : -1;
+    }
+}
+
+//  windows[] ĵǰؽȫλͼ
+void rebuild_window_maps() {
+    memset(idle_windows, 0, sizeof(idle_windows));
+    memset(idle_summary, 0, sizeof(idle_summary));
+    memset(idle_any, 0, sizeof(idle_any));
+    memset(open_map, 0, sizeof(open_map));
+    memset(skill_windows, 0, sizeof(skill_windows));
+    memset(open_count, 0, sizeof(open_count));
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        SkillMask skills = windows[i].skills;
+        while (skills) {
+            int b = lowest_bit(skills);
+            skills &= skills - 1;
+            skill_windows[b][i / 64] |= 1ULL << (i % 64);
+        }
+        if (windows[i].is_open) {
+            set_window_open_bits(i, true);
+            if (!windows[i].is_busy) {
+                set_idle_bits(i, true);
+            }
+        }
+    }
+}
+
 void init_windows() {
+    SkillMask all = ALL_SKILLS(params.business_types);
+    
     for (int i = 0; i < MAX_WINDOWS; i++) {
         windows[i].id = i;
+        windows[i].skills = window_skills[i] == 0 ? all : (window_skills[i] & all);
         windows[i].is_open = (i < params.initial_windows);
         windows[i].is_busy = false;
         windows[i].total_busy_time = 0;
         windows[i].total_idle_time = 0;
+        windows[i].idle_start = current_time;
         windows[i].served_count = 0;
         windows[i].busy_start = 0;
     }
+    rebuild_window_maps();
     active_windows = params.initial_windows;
 }
 
@@ -178,10 +746,15 @@ void open_window(int window_id) {
     if (window_id < MAX_WINDOWS && !windows[window_id].is_open && active_windows < params.max_windows) {
         windows[window_id].is_open = true;
         active_windows++;
+        set_window_open_bits(window_id, true);
+        set_window_idle(window_id, true);
+        record_event(EVENT_OPEN, -1, window_id);
         if (log_events && log_file != NULL) {
             fprintf(log_file, "ʱ %.2f:  %d \n", current_time, window_id);
         }
-        printf("ʱ %.2f:  %d \n", current_time, window_id);
+        if (print_events) {
+            printf("ʱ %.2f:  %d \n", current_time, window_id);
+        }
     }
 }
 
@@ -190,53 +763,72 @@ void close_window(int window_id) {
         !windows[window_id].is_busy && active_windows > params.min_windows) {
         windows[window_id].is_open = false;
         active_windows--;
+        set_window_open_bits(window_id, false);
+        set_window_idle(window_id, false);
+        record_event(EVENT_CLOSE, -1, window_id);
         if (log_events && log_file != NULL) {
             fprintf(log_file, "ʱ %.2f:  %d ر\n", current_time, window_id);
         }
-        printf("ʱ %.2f:  %d ر\n", current_time, window_id);
+        if (print_events) {
+            printf("ʱ %.2f:  %d ر\n", current_time, window_id);
+        }
     }
 }
 
-int find_idle_window() {
-    for (int i = 0; i < MAX_WINDOWS; i++) {
-        if (windows[i].is_open && !windows[i].is_busy) {
-            return i;
-        }
+// ҿɰָҵıСĿд
+int find_idle_window(int business) {
+    unsigned long long summary = idle_summary[business];
+    if (summary == 0) {
+        return -1;
     }
-    return -1;
+    int word = lowest_bit(summary);
+    return word * 64 + lowest_bit(idle_windows[business][word]);
 }
 
 // ==================== ͻȺ ====================
-Customer get_next_customer() {
-    static int priority_counter = 0;
+// Ϊ skills ܵĴѡͻȰȱ
+// ڸܰҵȡĶ׿ͻ
+Customer get_next_customer(SkillMask skills) {
+    SkillMask priority_ready = skills & waiting_mask[1];
+    SkillMask normal_ready = skills & waiting_mask[0];
     Customer customer;
+    int cls;
     
-    // ҵص
-    if (!is_queue_empty(&priority_queue) && !is_queue_empty(&normal_queue)) {
-        // ʹĸȡͻ
-        if ((rand() % 100) < (int)(params.priority_ratio * 100)) {
-            customer = dequeue(&priority_queue);
-        } else {
-            customer = dequeue(&normal_queue);
-        }
+    // ͻпɰ
+    if (priority_ready && normal_ready) {
+        // ʹĸȡͻ
+        cls = ((rand() % 100) < (int)(params.priority_ratio * 100)) ? 1 : 0;
     } 
-    // ֻһпͻ
-    else if (!is_queue_empty(&priority_queue)) {
-        customer = dequeue(&priority_queue);
+    else if (priority_ready) {
+        cls = 1;
     } 
-    else if (!is_queue_empty(&normal_queue)) {
-        customer = dequeue(&normal_queue);
+    else if (normal_ready) {
+        cls = 0;
     } 
     else {
         customer.id = -1; // ʾûпͻ
+        return customer;
     }
     
-    return customer;
+    SkillMask ready = cls == 1 ? priority_ready : normal_ready;
+    Queue* queues = cls == 1 ? priority_queue : normal_queue;
+    int best = lowest_bit(ready);
+    ready &= ready - 1;
+    while (ready) {
+        int b = lowest_bit(ready);
+        ready &= ready - 1;
+        if (queues[b].front->customer.arrival_time < queues[best].front->customer.arrival_time) {
+            best = b;
+        }
+    }
+    
+    return dequeue_customer(cls, best);
 }
 
 void assign_customer_to_window(int window_id, Customer customer) {
     if (window_id >= 0 && window_id < MAX_WINDOWS) {
         windows[window_id].is_busy = true;
+        set_window_idle(window_id, false);
         windows[window_id].current_customer = customer;
         windows[window_id].busy_start = current_time;
         windows[window_id].served_count++;
@@ -245,6 +837,16 @@ void assign_customer_to_window(int window_id, Customer customer) {
         customers[customer.id - 1].start_time = current_time;
         customers[customer.id - 1].waiting_time = current_time - customer.arrival_time;
         customers[customer.id - 1].served_by = window_id;
+        schedule_event(&event_heap, FINISH_SLOT(window_id), current_time + customer.service_time);
+        
+        // IPAʼʱ津¼ƶʱټϷʱĵ
+        if (gradient_estimation) {
+            for (int k = 0; k < GRAD_PARAMS; k++) {
+                customers[customer.id - 1].wait_grad[k] = current_time_grad[k] - customer.arrival_grad[k];
+                windows[window_id].finish_grad[k] = current_time_grad[k] + customer.service_grad[k];
+            }
+        }
+        record_event(EVENT_START, customer.id, window_id);
         
         if (log_events && log_file != NULL) {
             fprintf(log_file, "ʱ %.2f: ͻ %d (: %s) ڴ %d ʼ񣬵ȴʱ: %.2f\n", 
@@ -252,10 +854,12 @@ void assign_customer_to_window(int window_id, Customer customer) {
                    customer.type == 1 ? "" : "ͨ",
                    window_id, current_time - customer.arrival_time);
         }
-        printf("ʱ %.2f: ͻ %d (: %s) ڴ %d ʼ񣬵ȴʱ: %.2f\n", 
-               current_time, customer.id, 
-               customer.type == 1 ? "" : "ͨ",
-               window_id, current_time - customer.arrival_time);
+        if (print_events) {
+            printf("ʱ %.2f: ͻ %d (: %s) ڴ %d ʼ񣬵ȴʱ: %.2f\n", 
+                   current_time, customer.id, 
+                   customer.type == 1 ? "" : "ͨ",
+                   window_id, current_time - customer.arrival_time);
+        }
     }
 }
 
@@ -264,41 +868,133 @@ void finish_service(int window_id) {
         Customer customer = windows[window_id].current_customer;
         double service_duration = current_time - windows[window_id].busy_start;
         
+        if (gradient_estimation) {
+            memcpy(current_time_grad, windows[window_id].finish_grad, sizeof(current_time_grad));
+        }
+        
         windows[window_id].is_busy = false;
         windows[window_id].total_busy_time += service_duration;
+        if (windows[window_id].is_open) {
+            set_window_idle(window_id, true);
+        }
         windows[window_id].busy_end = current_time;
         
         // ¿ͻʱ
         customers[customer.id - 1].finish_time = current_time;
+        record_event(EVENT_FINISH, customer.id, window_id);
         
         if (log_events && log_file != NULL) {
             fprintf(log_file, "ʱ %.2f: ͻ %d ڴ %d ɷ񣬷ʱ: %.2f\n", 
                    current_time, customer.id, window_id, service_duration);
         }
-        printf("ʱ %.2f: ͻ %d ڴ %d ɷ񣬷ʱ: %.2f\n", 
-               current_time, customer.id, window_id, service_duration);
+        if (print_events) {
+            printf("ʱ %.2f: ͻ %d ڴ %d ɷ񣬷ʱ: %.2f\n", 
+                   current_time, customer.id, window_id, service_duration);
+        }
     }
 }
 
 // ==================== ̬ڵ ====================
+// С max_windows Ĵڵ word жӦλ
+unsigned long long window_limit_mask(int word) {
+    int rest = params.max_windows - word * 64;
+    if (rest >= 64) return ~0ULL;
+    if (rest <= 0) return 0;
+    return (1ULL << rest) - 1;
+}
+
+// С max_windowsܰ businessΪ-1ʱޣıСĹرմ
+int find_closed_window(int business) {
+    for (int k = 0; k < WINDOW_WORDS; k++) {
+        unsigned long long bits = ~open_map[k] & window_limit_mask(k);
+        if (business >= 0) {
+            bits &= skill_windows[business][k];
+        }
+        if (bits) {
+            return k * 64 + lowest_bit(bits);
+        }
+    }
+    return -1;
+}
+
+// ҵ b ŶõĿͻĵʱ
+double oldest_waiting_arrival(int b) {
+    double oldest = INFINITY;
+    if (priority_queue[b].front != NULL) {
+        oldest = priority_queue[b].front->customer.arrival_time;
+    }
+    if (normal_queue[b].front != NULL && normal_queue[b].front->customer.arrival_time < oldest) {
+        oldest = normal_queue[b].front->customer.arrival_time;
+    }
+    return oldest;
+}
+
+// ѡҪĴڣչûпŴڿɰҵȴõҵ
+// ǵȴõҵ񣻶ûкʴʱȡСĹرմ
+int choose_window_to_open() {
+    SkillMask waiting = waiting_mask[0] | waiting_mask[1];
+    int best = -1, best_window = -1;
+    double best_time = INFINITY;
+    
+    for (int pass = 0; pass < 2 && best_window == -1; pass++) {
+        SkillMask candidates = waiting;
+        while (candidates) {
+            int b = lowest_bit(candidates);
+            candidates &= candidates - 1;
+            if (pass == 0 && open_count[b] > 0) continue;
+            double oldest = oldest_waiting_arrival(b);
+            if (best != -1 && oldest >= best_time) continue;
+            int w = find_closed_window(b);
+            if (w != -1) {
+                best = b;
+                best_time = oldest;
+                best_window = w;
+            }
+        }
+    }
+    return best_window != -1 ? best_window : find_closed_window(-1);
+}
+
+// صôǷʹĳŶӵҵûпŴڿɰ
+bool is_last_server(int window_id) {
+    SkillMask needed = windows[window_id].skills & (waiting_mask[0] | waiting_mask[1]);
+    while (needed) {
+        int b = lowest_bit(needed);
+        needed &= needed - 1;
+        if (open_count[b] <= 1) return true;
+    }
+    return false;
+}
+
 void adjust_windows() {
-    int total_queue_size = queue_size(&normal_queue) + queue_size(&priority_queue);
+    int total_queue_size = waiting_total;
     
-    // ߼гȳֵһдڿԿ
+    // ߼гȳֵһдڿԿҵʱӴŶӿͻ
+    // ҵ񱣳ԭΪ´ڵһλͻſʼ
     if (total_queue_size > params.open_threshold) {
-        for (int i = 0; i < params.max_windows; i++) {
-            if (!windows[i].is_open) {
-                open_window(i);
-                break;
+        if (active_windows >= params.max_windows) return;
+        int window_id = choose_window_to_open();
+        if (window_id != -1) {
+            open_window(window_id);
+            if (params.business_types <= 1) return;
+            Customer next_customer = get_next_customer(windows[window_id].skills);
+            if (next_customer.id != -1) {
+                assign_customer_to_window(window_id, next_customer);
             }
         }
     }
-    // ش߼гȵֵпдڿԹ
+    // ش߼гȵֵпдڿԹأĳҵʣĿŴ
     else if (total_queue_size < params.close_threshold) {
-        for (int i = 0; i < params.max_windows; i++) {
-            if (windows[i].is_open && !windows[i].is_busy) {
-                close_window(i);
-                break;
+        if (active_windows <= params.min_windows) return;
+        for (int k = 0; k < WINDOW_WORDS; k++) {
+            unsigned long long bits = idle_any[k] & window_limit_mask(k);
+            while (bits) {
+                int i = k * 64 + lowest_bit(bits);
+                bits &= bits - 1;
+                if (!is_last_server(i)) {
+                    close_window(i);
+                    return;
+                }
             }
         }
     }
@@ -306,120 +1002,224 @@ void adjust_windows() {
 
 // ==================== ͻﺯ ====================
 void customer_arrival(Customer customer) {
+    record_event(EVENT_ARRIVAL, customer.id, -1);
+    if (gradient_estimation) {
+        memcpy(current_time_grad, customer.arrival_grad, sizeof(current_time_grad));
+    }
+    
+    // ͻֱ뿪
+    if (params.balk_threshold > 0 && waiting_total >= params.balk_threshold) {
+        customers[customer.id - 1].abandoned = ABANDON_BALK;
+        record_event(EVENT_BALK, customer.id, -1);
+        if (log_events && log_file != NULL) {
+            fprintf(log_file, "ʱ %.2f: ͻ %d Ŷ %dŶ\n", 
+                   current_time, customer.id, waiting_total);
+        }
+        if (print_events) {
+            printf("ʱ %.2f: ͻ %d Ŷ %dŶ\n", 
+                   current_time, customer.id, waiting_total);
+        }
+        adjust_windows();
+        return;
+    }
+    
     // ͻӦ
+    enqueue_customer(customer);
     if (customer.type == 1) {
-        enqueue(&priority_queue, customer);
         if (log_events && log_file != NULL) {
             fprintf(log_file, "ʱ %.2f: ȿͻ %d Ԥʱ: %.2f\n", 
                    customer.arrival_time, customer.id, customer.service_time);
         }
-        printf("ʱ %.2f: ȿͻ %d Ԥʱ: %.2f\n", 
-               customer.arrival_time, customer.id, customer.service_time);
+        if (print_events) {
+            printf("ʱ %.2f: ȿͻ %d Ԥʱ: %.2f\n", 
+                   customer.arrival_time, customer.id, customer.service_time);
+        }
     } else {
-        enqueue(&normal_queue, customer);
         if (log_events && log_file != NULL) {
             fprintf(log_file, "ʱ %.2f: ͨͻ %d Ԥʱ: %.2f\n", 
                    customer.arrival_time, customer.id, customer.service_time);
         }
-        printf("ʱ %.2f: ͨͻ %d Ԥʱ: %.2f\n", 
-               customer.arrival_time, customer.id, customer.service_time);
+        if (print_events) {
+            printf("ʱ %.2f: ͨͻ %d Ԥʱ: %.2f\n", 
+                   customer.arrival_time, customer.id, customer.service_time);
+        }
     }
     
     // Էͻд
-    int idle_window = find_idle_window();
+    int idle_window = find_idle_window(customer.business);
     if (idle_window != -1) {
-        Customer next_customer = get_next_customer();
+        Customer next_customer = get_next_customer(windows[idle_window].skills);
         if (next_customer.id != -1) {
             assign_customer_to_window(idle_window, next_customer);
         }
     }
     
+    // ŶӵĿͻʼļʱ
+    if (queue_nodes[customer.id - 1] != NULL && customer.patience > 0) {
+        schedule_event(&event_heap, RENEGE_SLOT(customer.id - 1), customer.arrival_time + customer.patience);
+    }
+    
+    // 
+    adjust_windows();
+}
+
+// ==================== ͻ뿪 ====================
+void customer_renege(int index) {
+    Customer customer = remove_waiting_customer(index);
+    
+    // ʱ޹أ뿪ʱ浽ʱƶ
+    if (gradient_estimation) {
+        memcpy(current_time_grad, customer.arrival_grad, sizeof(current_time_grad));
+    }
+    
+    customers[index].abandoned = ABANDON_RENEGE;
+    customers[index].waiting_time = current_time - customer.arrival_time;
+    record_event(EVENT_RENEGE, customer.id, -1);
+    if (log_events && log_file != NULL) {
+        fprintf(log_file, "ʱ %.2f: ͻ %d ȴ %.2f Ӻ뿪\n", 
+               current_time, customer.id, current_time - customer.arrival_time);
+    }
+    if (print_events) {
+        printf("ʱ %.2f: ͻ %d ȴ %.2f Ӻ뿪\n", 
+               current_time, customer.id, current_time - customer.arrival_time);
+    }
+    
     // 
     adjust_windows();
 }
 
 // ==================== ĺ ====================
-void run_simulation() {
+void start_simulation() {
     init_windows();
-    init_queue(&priority_queue, 1);
-    init_queue(&normal_queue, 0);
+    init_all_queues();
+    init_event_heap(&event_heap, EVENT_SLOTS);
+    reset_event_digest();
+    peak_waiting = 0;
     
-    // ¼ѭ
-    while (current_time < params.simulation_time) {
-        // һ¼ͻɣ
-        double next_event_time = params.simulation_time + 1;
-        int next_event_type = -1;
-        int next_event_window = -1;
-        int next_event_customer_index = -1;
-        
-        // Ƿпͻ
-        for (int i = 0; i < params.customer_count; i++) {
-            if (customers[i].arrival_time > current_time && 
-                customers[i].arrival_time < next_event_time) {
-                next_event_time = customers[i].arrival_time;
-                next_event_type = 0; // ¼
-                next_event_customer_index = i;
-            }
-        }
+    for (int i = 0; i < params.customer_count; i++) {
+        schedule_event(&event_heap, ARRIVAL_SLOT(i), customers[i].arrival_time);
+    }
+}
+
+// һ¼ѽʱ false
+bool step_simulation() {
+    if (current_time >= params.simulation_time) {
+        flush_idle_time();
+        return false;
+    }
+    
+    // ȡһ¼1ڵ¼Դ꣩
+    int slot = peek_next_event(&event_heap);
+    
+    if (slot == -1 || event_heap.time[slot] >= params.simulation_time + 1) {
+        // ûи¼´ڿʱ
+        current_time = params.simulation_time;
+        flush_idle_time();
+        return false;
+    }
+    
+    double next_event_time = event_heap.time[slot];
+    pop_next_event(&event_heap);
+    
+    // ʱ
+    current_time = next_event_time;
+    
+    // ¼
+    if (slot < FINISH_SLOT_BASE) {
+        // ͻ
+        customer_arrival(customers[slot]);
+    } else if (slot < RENEGE_SLOT_BASE) {
+        // 
+        int window_id = slot - FINISH_SLOT_BASE;
+        finish_service(window_id);
         
-        // Ƿз
-        for (int i = 0; i < MAX_WINDOWS; i++) {
-            if (windows[i].is_busy) {
-                double finish_time = windows[i].busy_start + 
-                                   windows[i].current_customer.service_time;
-                if (finish_time > current_time && finish_time < next_event_time) {
-                    next_event_time = finish_time;
-                    next_event_type = 1; // ¼
-                    next_event_window = i;
-                }
-            }
+        // һͻ
+        Customer next_customer = get_next_customer(windows[window_id].skills);
+        if (next_customer.id != -1) {
+            assign_customer_to_window(window_id, next_customer);
         }
         
-        if (next_event_type == -1) {
-            // ûи¼´ڿʱ
-            for (int i = 0; i < MAX_WINDOWS; i++) {
-                if (windows[i].is_open && !windows[i].is_busy) {
-                    windows[i].total_idle_time += (params.simulation_time - current_time);
+        // 
+        adjust_windows();
+    } else {
+        // ͻȴʱ뿪
+        customer_renege(slot - RENEGE_SLOT_BASE);
+    }
+    if (waiting_total > peak_waiting) peak_waiting = waiting_total;
+    return true;
+}
+
+void run_simulation() {
+    start_simulation();
+    
+    // ¼ѭ
+    while (step_simulation()) {
+    }
+}
+
+// ==================== ͳƼ㺯 ====================
+// tֲ0.975λ±Ϊɶȣ-1
+const double t_quantile_975[GRADIENT_BATCHES] = {
+    0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262
+};
+
+// IPA ָֻ/ҿͻܾŶӡ;뿪ʱƫ
+// ܾ뿪ʹ·Բģͺ͵δ¼
+bool gradient_supported() {
+    return params.balk_threshold == 0 && params.mean_patience == 0 &&
+           workload_model == NULL && arrival_process == NULL;
+}
+
+// ֵƸͻƽȴʱ䵼䣨˳
+void calculate_gradients() {
+    if (!gradient_supported()) {
+        return;
+    }
+    for (int cls = 0; cls < 2; cls++) {
+        int n = stats.served_count[cls];
+        for (int k = 0; k < GRAD_PARAMS; k++) {
+            double batch_sum[GRADIENT_BATCHES] = {0};
+            int batch_count[GRADIENT_BATCHES] = {0};
+            double total = 0;
+            int rank = 0;
+            
+            if (n == 0) continue;
+            for (int i = 0; i < params.customer_count; i++) {
+                if (customers[i].finish_time > 0 && customers[i].type == cls) {
+                    int b = (int)((long)rank * GRADIENT_BATCHES / n);
+                    batch_sum[b] += customers[i].wait_grad[k];
+                    batch_count[b]++;
+                    total += customers[i].wait_grad[k];
+                    rank++;
                 }
             }
-            current_time = params.simulation_time;
-            break;
-        }
-        
-        // ´ڿʱ䣨ӵǰʱ䵽һ¼ʱ䣩
-        for (int i = 0; i < MAX_WINDOWS; i++) {
-            if (windows[i].is_open && !windows[i].is_busy) {
-                windows[i].total_idle_time += (next_event_time - current_time);
-            }
-        }
-        
-        // ʱ
-        current_time = next_event_time;
-        
-        // ¼
-        if (next_event_type == 0) {
-            // ͻ
-            customer_arrival(customers[next_event_customer_index]);
-        } else if (next_event_type == 1) {
-            // 
-            finish_service(next_event_window);
             
-            // һͻ
-            Customer next_customer = get_next_customer();
-            if (next_customer.id != -1) {
-                assign_customer_to_window(next_event_window, next_customer);
+            double mean = total / n;
+            double var = 0;
+            int batches = 0;
+            for (int b = 0; b < GRADIENT_BATCHES; b++) {
+                if (batch_count[b] > 0) {
+                    double d = batch_sum[b] / batch_count[b] - mean;
+                    var += d * d;
+                    batches++;
+                }
             }
-            
-            // 
-            adjust_windows();
+            stats.wait_grad[cls][k] = mean;
+            stats.wait_grad_half[cls][k] = batches > 1 ?
+                t_quantile_975[batches - 1] * sqrt(var / (batches - 1) / batches) : 0;
         }
     }
 }
 
-// ==================== ͳƼ㺯 ====================
+int wait_histogram_bin(double wait) {
+    int bin = (int)(wait / WAIT_HIST_WIDTH);
+    return bin < WAIT_HIST_BINS ? bin : WAIT_HIST_BINS - 1;
+}
+
 void calculate_statistics() {
     // ʼͳ
     memset(&stats, 0, sizeof(Statistics));
+    stats.max_waiting = peak_waiting;
     
     // ȴʱͳ
     for (int i = 0; i < params.customer_count; i++) {
@@ -427,10 +1227,32 @@ void calculate_statistics() {
             int type = customers[i].type;
             stats.total_wait_time[type] += customers[i].waiting_time;
             stats.served_count[type]++;
+            stats.business_served[customers[i].business]++;
+            stats.business_wait_time[customers[i].business] += customers[i].waiting_time;
             
             if (customers[i].waiting_time > stats.max_wait_time[type]) {
                 stats.max_wait_time[type] = customers[i].waiting_time;
             }
+            stats.wait_histogram[type][wait_histogram_bin(customers[i].waiting_time)]++;
+        }
+    }
+    
+    // ʧͳ
+    for (int i = 0; i < params.customer_count; i++) {
+        int type = customers[i].type;
+        if (customers[i].arrival_time <= current_time) {
+            stats.arrived_count[type]++;
+        }
+        if (customers[i].abandoned == ABANDON_BALK) {
+            stats.balked_count[type]++;
+        } else if (customers[i].abandoned == ABANDON_RENEGE) {
+            stats.reneged_count[type]++;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        if (stats.arrived_count[i] > 0) {
+            stats.abandon_rate[i] = (double)(stats.balked_count[i] + stats.reneged_count[i]) /
+                                    stats.arrived_count[i] * 100;
         }
     }
     
@@ -441,6 +1263,10 @@ void calculate_statistics() {
         }
     }
     
+    if (gradient_estimation) {
+        calculate_gradients();
+    }
+    
     // 㴰
     for (int i = 0; i < MAX_WINDOWS; i++) {
         if (windows[i].is_open) {
@@ -474,6 +1300,7 @@ void print_statistics() {
     printf("ʱ: %.2f \n", current_time);
     printf("ܷͻ: %d\n", stats.total_served);
     printf("ϵͳ: %.2f ͻ/Сʱ\n", stats.throughput);
+    printf("¼ժҪ: %016llx (%d ¼)\n", event_digest, event_count);
     
     printf("\n--- ȴʱͳ ---\n");
     printf("ͨͻ: ƽȴ %.2f , ȴ %.2f ,  %d \n",
@@ -481,6 +1308,34 @@ void print_statistics() {
     printf("ȿͻ: ƽȴ %.2f , ȴ %.2f ,  %d \n",
            stats.avg_wait_time[1], stats.max_wait_time[1], stats.served_count[1]);
     
+    if (params.balk_threshold > 0 || params.mean_patience > 0) {
+        printf("\n--- ͻʧͳ ---\n");
+        printf("ͨͻ:  %d , ܾŶ %d , ;뿪 %d , ʧ %.2f%%\n",
+               stats.arrived_count[0], stats.balked_count[0], stats.reneged_count[0], stats.abandon_rate[0]);
+        printf("ȿͻ:  %d , ܾŶ %d , ;뿪 %d , ʧ %.2f%%\n",
+               stats.arrived_count[1], stats.balked_count[1], stats.reneged_count[1], stats.abandon_rate[1]);
+    }
+    
+    if (gradient_estimation) {
+        printf("\n--- ݶȹ (IPA, 95%%) ---\n");
+        printf("ͨͻ: dȴ/d %.4f  %.4f, dȴ/d %.4f  %.4f\n",
+               stats.wait_grad[0][GRAD_SERVICE_RATE], stats.wait_grad_half[0][GRAD_SERVICE_RATE],
+               stats.wait_grad[0][GRAD_ARRIVAL_RATE], stats.wait_grad_half[0][GRAD_ARRIVAL_RATE]);
+        printf("ȿͻ: dȴ/d %.4f  %.4f, dȴ/d %.4f  %.4f\n",
+               stats.wait_grad[1][GRAD_SERVICE_RATE], stats.wait_grad_half[1][GRAD_SERVICE_RATE],
+               stats.wait_grad[1][GRAD_ARRIVAL_RATE], stats.wait_grad_half[1][GRAD_ARRIVAL_RATE]);
+    }
+    
+    if (params.business_types > 1) {
+        printf("\n--- ҵͳ ---\n");
+        for (int b = 0; b < params.business_types; b++) {
+            if (stats.business_served[b] > 0) {
+                printf("ҵ %d:  %d , ƽȴ %.2f \n", b, stats.business_served[b],
+                       stats.business_wait_time[b] / stats.business_served[b]);
+            }
+        }
+    }
+    
     printf("\n--- ͳ ---\n");
     int open_window_count = 0;
     for (int i = 0; i < MAX_WINDOWS; i++) {
@@ -494,8 +1349,8 @@ void print_statistics() {
     printf("ܼƿŴ: %d\n", open_window_count);
     
     printf("\n--- ״̬ ---\n");
-    printf("ȶʣͻ: %d\n", queue_size(&priority_queue));
-    printf("ͨʣͻ: %d\n", queue_size(&normal_queue));
+    printf("ȶʣͻ: %d\n", waiting_in_class(1));
+    printf("ͨʣͻ: %d\n", waiting_in_class(0));
     
     // д־ļ
     if (log_file != NULL) {
@@ -506,45 +1361,786 @@ void print_statistics() {
         fprintf(log_file, "ʱ: %.2f \n", current_time);
         fprintf(log_file, "ܷͻ: %d\n", stats.total_served);
         fprintf(log_file, "ϵͳ: %.2f ͻ/Сʱ\n", stats.throughput);
+        fprintf(log_file, "¼ժҪ: %016llx (%d ¼)\n", event_digest, event_count);
     }
 }
 
-// ==================== ͻɺ ====================
-void generate_customers_random(int count, int seed) {
-    srand(seed);
-    params.customer_count = count > MAX_CUSTOMERS ? MAX_CUSTOMERS : count;
+// ==================== ֲ ====================
+//  rand() ƴ30λȵ (0,1) RAND_MAX ֻ32767
+double uniform01() {
+    return ((rand() & 0x7fff) * 32768.0 + (rand() & 0x7fff) + 0.5) / 1073741824.0;
+}
+
+// Vose O(n)֮ÿγ O(1)
+void build_alias_table(const double* weights, int n, double* prob, int* alias) {
+    int* small = (int*)malloc(sizeof(int) * n);
+    int* large = (int*)malloc(sizeof(int) * n);
+    int small_count = 0, large_count = 0;
+    double total = 0;
     
-    double arrival_rate = 2.0; // ƽÿӵ2ͻ
-    double service_rate = 3.0; // ƽʱ3
+    for (int i = 0; i < n; i++) total += weights[i];
+    for (int i = 0; i < n; i++) {
+        prob[i] = weights[i] * n / total;
+        alias[i] = i;
+        if (prob[i] < 1.0) small[small_count++] = i;
+        else large[large_count++] = i;
+    }
+    while (small_count > 0 && large_count > 0) {
+        int s = small[--small_count];
+        int l = large[--large_count];
+        alias[s] = l;
+        prob[l] -= 1.0 - prob[s];
+        if (prob[l] < 1.0) small[small_count++] = l;
+        else large[large_count++] = l;
+    }
+    // ʣĸƫ1
+    while (large_count > 0) prob[large[--large_count]] = 1.0;
+    while (small_count > 0) prob[small[--small_count]] = 1.0;
     
-    for (int i = 0; i < params.customer_count; i++) {
-        customers[i].id = next_customer_id++;
-        customers[i].type = (rand() % 100 < 30) ? 1 : 0; // 30%ȿͻ
-        customers[i].vip_level = customers[i].type == 1 ? (rand() % 3 + 1) : 0;
+    free(small);
+    free(large);
+}
+
+// һͬʱǷȡ*frac ʣľС
+int alias_pick(const double* prob, const int* alias, int n, double* frac) {
+    double u = uniform01() * n;
+    int i = (int)u;
+    if (i >= n) i = n - 1;
+    double v = u - i;
+    if (v < prob[i]) {
+        *frac = v / prob[i];
+        return i;
+    }
+    *frac = (v - prob[i]) / (1.0 - prob[i]);
+    return alias[i];
+}
+
+Distribution* new_distribution(int kind) {
+    Distribution* d = (Distribution*)calloc(1, sizeof(Distribution));
+    d->kind = kind;
+    return d;
+}
+
+void free_distribution(Distribution* d) {
+    if (d == NULL) return;
+    free(d->values);
+    free(d->prob);
+    free(d->alias);
+    free(d->phases);
+    free(d->rates);
+    free(d);
+}
+
+Distribution* create_exponential(double rate) {
+    Distribution* d = new_distribution(DIST_EXPONENTIAL);
+    d->a = rate;
+    return d;
+}
+
+// edges  bins+1 ߽磬weights ΪƵ
+Distribution* create_histogram(const double* edges, const double* weights, int bins) {
+    clock_t begin = clock();
+    Distribution* d = new_distribution(DIST_HISTOGRAM);
+    d->n = bins;
+    d->values = (double*)malloc(sizeof(double) * (bins + 1));
+    d->prob = (double*)malloc(sizeof(double) * bins);
+    d->alias = (int*)malloc(sizeof(int) * bins);
+    memcpy(d->values, edges, sizeof(double) * (bins + 1));
+    build_alias_table(weights, bins, d->prob, d->alias);
+    d->setup_ms = (double)(clock() - begin) * 1000 / CLOCKS_PER_SEC;
+    return d;
+}
+
+Distribution* create_samples(const double* samples, int n) {
+    Distribution* d = new_distribution(DIST_SAMPLES);
+    d->n = n;
+    d->values = (double*)malloc(sizeof(double) * n);
+    memcpy(d->values, samples, sizeof(double) * n);
+    return d;
+}
+
+Distribution* create_lognormal(double mu, double sigma) {
+    Distribution* d = new_distribution(DIST_LOGNORMAL);
+    d->a = mu;
+    d->b = sigma;
+    return d;
+}
+
+Distribution* create_gamma(double shape, double scale) {
+    Distribution* d = new_distribution(DIST_GAMMA);
+    d->a = shape;
+    d->b = scale;
+    return d;
+}
+
+// λͷֲԸ weights[j] ߵ j ֧÷֧Ϊ phases[j]  rates[j] ָλ
+Distribution* create_phase_type(const double* weights, const int* phases, const double* rates, int branches) {
+    clock_t begin = clock();
+    Distribution* d = new_distribution(DIST_PHASE_TYPE);
+    d->n = branches;
+    d->prob = (double*)malloc(sizeof(double) * branches);
+    d->alias = (int*)malloc(sizeof(int) * branches);
+    d->phases = (int*)malloc(sizeof(int) * branches);
+    d->rates = (double*)malloc(sizeof(double) * branches);
+    memcpy(d->phases, phases, sizeof(int) * branches);
+    memcpy(d->rates, rates, sizeof(double) * branches);
+    build_alias_table(weights, branches, d->prob, d->alias);
+    d->setup_ms = (double)(clock() - begin) * 1000 / CLOCKS_PER_SEC;
+    return d;
+}
+
+// Marsaglia-Tsang ٤ֲ״<1ʱ Gamma(a+1)*U^(1/a)
+double gamma_variate(double shape, double normal, double* spare_normal, bool* has_spare) {
+    double boost = 1.0;
+    if (shape < 1.0) {
+        boost = pow(uniform01(), 1.0 / shape);
+        shape += 1.0;
+    }
+    double dd = shape - 1.0 / 3.0, c = 1.0 / sqrt(9.0 * dd);
+    while (true) {
+        double x = normal, v = 1.0 + c * x;
+        if (v > 0) {
+            v = v * v * v;
+            double u = uniform01();
+            if (log(u) < 0.5 * x * x + dd - dd * v + dd * log(v)) {
+                return dd * v * boost;
+            }
+        }
+        // ܾȡ̬Box-Muller һβ
+        if (*has_spare) {
+            normal = *spare_normal;
+            *has_spare = false;
+        } else {
+            double r = sqrt(-2.0 * log(uniform01())), theta = 2.0 * PI * uniform01();
+            normal = r * cos(theta);
+            *spare_normal = r * sin(theta);
+            *has_spare = true;
+        }
+    }
+}
+
+// ֲһһ̯Խ֧Ŀ
+void fill_batch(Distribution* d) {
+    double spare = 0;
+    bool has_spare = false;
+    
+    for (int k = 0; k < DIST_BATCH; k += 2) {
+        double r = sqrt(-2.0 * log(uniform01())), theta = 2.0 * PI * uniform01();
+        double z[2] = {r * cos(theta), r * sin(theta)};
+        for (int j = 0; j < 2; j++) {
+            if (d->kind == DIST_LOGNORMAL) {
+                d->batch[k + j] = exp(d->a + d->b * z[j]);
+            } else {
+                d->batch[k + j] = gamma_variate(d->a, z[j], &spare, &has_spare) * d->b;
+            }
+        }
+    }
+    d->batch_pos = 0;
+    d->batch_len = DIST_BATCH;
+}
+
+double sample_distribution(Distribution* d) {
+    double frac;
+    
+    switch (d->kind) {
+        case DIST_HISTOGRAM: {
+            int i = alias_pick(d->prob, d->alias, d->n, &frac);
+            return d->values[i] + frac * (d->values[i + 1] - d->values[i]);
+        }
+        case DIST_SAMPLES: {
+            int i = (int)(uniform01() * d->n);
+            return d->values[i < d->n ? i : d->n - 1];
+        }
+        case DIST_LOGNORMAL:
+        case DIST_GAMMA:
+            if (d->batch_pos >= d->batch_len) {
+                fill_batch(d);
+            }
+            return d->batch[d->batch_pos++];
+        case DIST_PHASE_TYPE: {
+            int j = alias_pick(d->prob, d->alias, d->n, &frac);
+            double product = 1.0;
+            for (int k = 0; k < d->phases[j]; k++) {
+                product *= uniform01();
+            }
+            return -log(product) / d->rates[j];
+        }
+        default:
+            return -log(uniform01()) / d->a;
+    }
+}
+
+// ֲ岢³ȡͻ׸ʱ̣ʹÿηֻ
+void reset_workload_streams() {
+    if (workload_model == NULL) return;
+    for (int k = 0; k < workload_model->owned_count; k++) {
+        workload_model->owned[k]->batch_pos = workload_model->owned[k]->batch_len = 0;
+    }
+    if (workload_model->interarrival[0] != NULL) {
+        class_next_arrival[0] = sample_distribution(workload_model->interarrival[0]);
+        class_next_arrival[1] = sample_distribution(workload_model->interarrival[1]);
+    }
+}
+
+// ==================== ģͼغ ====================
+// ļÿһ# ͷΪעͣ
+//   service <ҵ|*> <VIPȼ|*> <ֲ>    ʱֲ
+//   arrival <0ͨ|1|*> <ֲ>            ֲͻγɵ
+// ֲд
+//   exp <>
+//   hist <1> <1> <Ƶ1> <2> <2> <Ƶ2> ...   βӡ߽ƵΪ
+//   samples <ֵ1> <ֵ2> ...
+//   lognormal <mu> <sigma>
+//   gamma <״> <߶>
+//   phase <1> <λ1> <1> <2> <λ2> <2> ...
+#define MAX_CONFIG_LINE 65536
+
+WorkloadModel* cached_workload_model = NULL; // ѼصģͣͬһļٴμʱֱӸ
+
+void free_workload_model(WorkloadModel* model) {
+    if (model == NULL) return;
+    for (int k = 0; k < model->owned_count; k++) {
+        free_distribution(model->owned[k]);
+    }
+    free(model);
+}
+
+// һʣķֲʧܷNULL
+Distribution* parse_distribution(char* kind, const char** reason) {
+    static double numbers[MAX_CONFIG_LINE / 2];
+    int count = 0;
+    char* token;
+    
+    *reason = "ʽ";
+    if (kind == NULL) return NULL;
+    while ((token = strtok(NULL, " \t\r\n")) != NULL && count < MAX_CONFIG_LINE / 2) {
+        char* end;
+        numbers[count++] = strtod(token, &end);
+        if (end == token || *end != '\0' || !isfinite(numbers[count - 1])) {
+            *reason = "зֲ";
+            return NULL;
+        }
+    }
+    
+    *reason = "ֲȡֵϷ";
+    if (strcmp(kind, "exp") == 0 && count == 1 && numbers[0] > 0) {
+        return create_exponential(numbers[0]);
+    }
+    if (strcmp(kind, "lognormal") == 0 && count == 2 && numbers[1] > 0) {
+        return create_lognormal(numbers[0], numbers[1]);
+    }
+    if (strcmp(kind, "gamma") == 0 && count == 2 && numbers[0] > 0 && numbers[1] > 0) {
+        return create_gamma(numbers[0], numbers[1]);
+    }
+    if (strcmp(kind, "samples") == 0 && count > 0) {
+        for (int i = 0; i < count; i++) {
+            if (numbers[i] < 0) {
+                *reason = "ֵΪ";
+                return NULL;
+            }
+        }
+        return create_samples(numbers, count);
+    }
+    if (strcmp(kind, "hist") == 0 && count > 0 && count % 3 == 0) {
+        int bins = count / 3;
+        // ÿΪ (߽ ұ߽ Ȩ)βӡ߽ȨΪ
+        for (int i = 0; i < bins; i++) {
+            double left = numbers[i * 3], right = numbers[i * 3 + 1];
+            if (left < 0 || right <= left || (i > 0 && left != numbers[i * 3 - 2])) {
+                *reason = "ֱͼ䲻߽粻";
+                return NULL;
+            }
+            if (numbers[i * 3 + 2] <= 0) {
+                *reason = "ֱͼȨرΪ";
+                return NULL;
+            }
+        }
+        double* edges = (double*)malloc(sizeof(double) * (bins + 1));
+        double* weights = (double*)malloc(sizeof(double) * bins);
+        for (int i = 0; i < bins; i++) {
+            edges[i] = numbers[i * 3];
+            weights[i] = numbers[i * 3 + 2];
+        }
+        edges[bins] = numbers[count - 2];
+        Distribution* d = create_histogram(edges, weights, bins);
+        free(edges);
+        free(weights);
+        return d;
+    }
+    if (strcmp(kind, "phase") == 0 && count > 0 && count % 3 == 0) {
+        int branches = count / 3;
+        static double weights[MAX_CONFIG_LINE / 6], rates[MAX_CONFIG_LINE / 6];
+        static int phases[MAX_CONFIG_LINE / 6];
+        for (int j = 0; j < branches; j++) {
+            weights[j] = numbers[j * 3];
+            rates[j] = numbers[j * 3 + 2];
+            if (weights[j] <= 0 || numbers[j * 3 + 1] < 1 || numbers[j * 3 + 1] != floor(numbers[j * 3 + 1]) ||
+                rates[j] <= 0) {
+                *reason = "λͷ֧ȨءΪλΪ";
+                return NULL;
+            }
+            phases[j] = (int)numbers[j * 3 + 1];
+        }
+        return create_phase_type(weights, phases, rates, branches);
+    }
+    return NULL;
+}
+
+// ±꣺"*" ʾȫ-1Ϊ [0, limit) ڵ
+bool parse_index(const char* text, int limit, int* value) {
+    char* end;
+    long v;
+    
+    if (strcmp(text, "*") == 0) {
+        *value = -1;
+        return true;
+    }
+    v = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || v < 0 || v >= limit) return false;
+    *value = (int)v;
+    return true;
+}
+
+void add_model_distribution(WorkloadModel* model, Distribution* d) {
+    model->owned[model->owned_count++] = d;
+    model->setup_ms += d->setup_ms;
+}
+
+// ൽֻһʱһఴԭеĲɵ30%ȱ
+void complete_arrival_streams(WorkloadModel* model) {
+    if ((model->interarrival[0] == NULL) == (model->interarrival[1] == NULL)) return;
+    for (int cls = 0; cls < 2; cls++) {
+        if (model->interarrival[cls] == NULL) {
+            Distribution* d = create_exponential(params.arrival_rate * (cls == 1 ? 0.3 : 0.7));
+            add_model_distribution(model, d);
+            model->interarrival[cls] = d;
+        }
+    }
+}
+
+WorkloadModel* load_workload_model(const char* path) {
+    static char line[MAX_CONFIG_LINE];
+    
+    if (cached_workload_model != NULL && strcmp(cached_workload_model->source, path) == 0) {
+        return cached_workload_model;
+    }
+    
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return NULL;
+    
+    WorkloadModel* model = (WorkloadModel*)calloc(1, sizeof(WorkloadModel));
+    strncpy(model->source, path, sizeof(model->source) - 1);
+    int line_number = 0;
+    
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char* target = strtok(line, " \t\r\n");
+        if (target == NULL || target[0] == '#') continue;
         
-        // ֲָɵ
-        double random_value = (rand() % 9000 + 1000) / 10000.0; // 0.1-1.0֮
-        double interarrival = -log(random_value) / arrival_rate;
+        int business = -1, vip = -1, cls = -1;
+        const char* reason = "ʽ";
+        Distribution* d;
+        bool is_service = strcmp(target, "service") == 0;
+        if (is_service) {
+            char* b = strtok(NULL, " \t\r\n");
+            char* v = strtok(NULL, " \t\r\n");
+            if (b == NULL || v == NULL) goto bad_line;
+            if (!parse_index(b, MAX_BUSINESS_TYPES, &business) || !parse_index(v, VIP_LEVELS, &vip)) {
+                reason = "ҵVIPȼΧ";
+                goto bad_line;
+            }
+        } else if (strcmp(target, "arrival") == 0) {
+            char* c = strtok(NULL, " \t\r\n");
+            if (c == NULL) goto bad_line;
+            if (!parse_index(c, 2, &cls)) {
+                reason = "ͻΪ 01  *";
+                goto bad_line;
+            }
+        } else {
+            goto bad_line;
+        }
+        
+        d = parse_distribution(strtok(NULL, " \t\r\n"), &reason);
+        if (d == NULL || model->owned_count >= MAX_MODEL_DISTS) {
+            if (d != NULL) reason = "ֲ";
+            free_distribution(d);
+            goto bad_line;
+        }
+        add_model_distribution(model, d);
         
-        if (i == 0) {
-            customers[i].arrival_time = interarrival;
+        if (is_service) {
+            for (int b = 0; b < MAX_BUSINESS_TYPES; b++) {
+                for (int v = 0; v < VIP_LEVELS; v++) {
+                    if ((business < 0 || b == business) && (vip < 0 || v == vip)) {
+                        model->service[b][v] = d;
+                    }
+                }
+            }
         } else {
-            customers[i].arrival_time = customers[i-1].arrival_time + interarrival;
+            for (int c = 0; c < 2; c++) {
+                if (cls < 0 || c == cls) model->interarrival[c] = d;
+            }
+        }
+        continue;
+        
+    bad_line:
+        printf("棺%s  %d %sѺ\n", path, line_number, reason);
+    }
+    fclose(file);
+    
+    complete_arrival_streams(model);
+    free_workload_model(cached_workload_model);
+    cached_workload_model = model;
+    return model;
+}
+
+// ʾҵ˫壨/ҵ񣩣Ϊ̬Ϊλͣ
+// ͨͻΪ٤ֲȲɸ򣩣ȿͻΪָɴأ
+WorkloadModel* builtin_workload_model() {
+    double edges[] = {0.5, 1.0, 2.0, 3.0, 5.0, 8.0, 12.0};
+    double weights[] = {20, 35, 8, 10, 20, 7};
+    double branch_weights[] = {0.8, 0.2};
+    int branch_phases[] = {2, 3};
+    double branch_rates[] = {1.0, 0.4};
+    double arrival_weights[] = {0.7, 0.3};
+    int arrival_phases[] = {1, 1};
+    double arrival_rates[] = {0.6, 0.12};
+    
+    if (cached_workload_model != NULL && strcmp(cached_workload_model->source, "<builtin>") == 0) {
+        return cached_workload_model;
+    }
+    
+    WorkloadModel* model = (WorkloadModel*)calloc(1, sizeof(WorkloadModel));
+    strcpy(model->source, "<builtin>");
+    Distribution* personal = create_histogram(edges, weights, 6);
+    Distribution* loan = create_lognormal(1.6, 0.5);
+    Distribution* forex = create_phase_type(branch_weights, branch_phases, branch_rates, 2);
+    add_model_distribution(model, personal);
+    add_model_distribution(model, loan);
+    add_model_distribution(model, forex);
+    for (int b = 0; b < MAX_BUSINESS_TYPES; b++) {
+        for (int v = 0; v < VIP_LEVELS; v++) {
+            model->service[b][v] = b % 3 == 0 ? personal : (b % 3 == 1 ? loan : forex);
+        }
+    }
+    
+    model->interarrival[0] = create_gamma(2.0, 0.6);
+    model->interarrival[1] = create_phase_type(arrival_weights, arrival_phases, arrival_rates, 2);
+    add_model_distribution(model, model->interarrival[0]);
+    add_model_distribution(model, model->interarrival[1]);
+    
+    free_workload_model(cached_workload_model);
+    cached_workload_model = model;
+    return model;
+}
+
+// ==================== ̺ ====================
+double exponential_variate(double rate) {
+    return -log(uniform01()) / rate;
+}
+
+// Ƿܲʱڵʱ̴0ϸʷǸҲȫΪ0
+// MMPP ״̬ʷǸҲȫΪ0ͣʱ
+bool arrival_process_valid(const ArrivalProcess* p) {
+    bool positive = false;
+    
+    if (p->scale <= 0 || p->batch_mean < 1) return false;
+    if (p->kind == ARRIVAL_SCHEDULE) {
+        if (p->knot_count < 2 || p->knot_count > MAX_RATE_KNOTS || p->knot_time[0] != 0) return false;
+        for (int k = 0; k < p->knot_count; k++) {
+            if (p->knot_rate[k] < 0 || (k > 0 && p->knot_time[k] <= p->knot_time[k - 1])) return false;
+            if (p->knot_rate[k] > 0) positive = true;
+        }
+        return positive;
+    }
+    if (p->kind == ARRIVAL_MMPP) {
+        if (p->state_count < 1 || p->state_count > MAX_MMPP_STATES) return false;
+        for (int i = 0; i < p->state_count; i++) {
+            if (p->state_rate[i] < 0 || p->state_leave[i] <= 0) return false;
+            if (p->state_rate[i] > 0) positive = true;
+        }
+        return positive;
+    }
+    return p->rate > 0;
+}
+
+// Ϸĵ̲ʱͣԶ
+void reset_arrival_process(ArrivalProcess* p) {
+    p->time = 0;
+    p->cycle_start = 0;
+    p->segment = 0;
+    p->state = 0;
+    p->state_end = p->kind == ARRIVAL_MMPP ? exponential_variate(p->state_leave[0]) : 0;
+    p->batch_left = 0;
+    p->candidates = 0;
+    p->accepted = 0;
+    if (!arrival_process_valid(p)) {
+        p->time = INFINITY;
+    }
+}
+
+double schedule_rate(const ArrivalProcess* p, int segment, double t) {
+    double t0 = p->knot_time[segment], t1 = p->knot_time[segment + 1];
+    double r0 = p->knot_rate[segment], r1 = p->knot_rate[segment + 1];
+    return r0 + (r1 - r0) * (t - t0) / (t1 - t0);
+}
+
+// ϡ軯ÿʵĽϴΪϽѡ㣬 (t)/Ͻ ܣ
+// ѡԽβʱӶβ¿ʼֲָ޼䣩ϽֻԱγ
+double next_schedule_time(ArrivalProcess* p) {
+    double t = p->time - p->cycle_start;
+    int last = p->knot_count - 1;
+    
+    while (true) {
+        int k = p->segment;
+        double segment_end = p->knot_time[k + 1];
+        double rate_max = p->scale * (p->knot_rate[k] > p->knot_rate[k + 1] ? p->knot_rate[k] : p->knot_rate[k + 1]);
+        double candidate = rate_max > 0 ? t + exponential_variate(rate_max) : segment_end;
+        
+        if (candidate >= segment_end) {
+            t = segment_end;
+            p->segment++;
+            if (p->segment == last) {
+                p->segment = 0;
+                p->cycle_start += p->knot_time[last];
+                t = 0;
+            }
+            continue;
+        }
+        
+        t = candidate;
+        p->candidates++;
+        if (uniform01() * rate_max <= p->scale * schedule_rate(p, k, t)) {
+            p->accepted++;
+            return p->cycle_start + t;
+        }
+    }
+}
+
+double next_mmpp_time(ArrivalProcess* p) {
+    double t = p->time;
+    
+    while (true) {
+        double rate = p->scale * p->state_rate[p->state];
+        double candidate = rate > 0 ? t + exponential_variate(rate) : p->state_end;
+        if (candidate < p->state_end) {
+            return candidate;
         }
         
+        // ״̬л
+        t = p->state_end;
+        double u = uniform01();
+        int next = p->state_count - 1;
+        for (int j = 0; j < p->state_count; j++) {
+            u -= p->state_jump[p->state][j];
+            if (u < 0) {
+                next = j;
+                break;
+            }
+        }
+        p->state = next;
+        p->state_end = t + exponential_variate(p->state_leave[next]);
+    }
+}
+
+// һλͻĵʱ̣ͬһͻͬʱ
+double next_arrival_time(ArrivalProcess* p) {
+    if (isinf(p->time)) {
+        return INFINITY;
+    }
+    if (p->batch_left > 0) {
+        p->batch_left--;
+        return p->time;
+    }
+    
+    if (p->kind == ARRIVAL_SCHEDULE) {
+        p->time = next_schedule_time(p);
+    } else if (p->kind == ARRIVAL_MMPP) {
+        p->time = next_mmpp_time(p);
+    } else {
+        p->time += exponential_variate(p->scale * p->rate);
+    }
+    
+    if (p->batch_mean > 1) {
+        // ηֲP(B=k) = (1-q) q^(k-1)ֵ 1/(1-q)
+        double q = 1 - 1 / p->batch_mean;
+        p->batch_left = (int)(log(uniform01()) / log(q));
+    }
+    return p->time;
+}
+
+// ƽʣͻ/ӣڰĿ긺
+double arrival_mean_rate(const ArrivalProcess* p) {
+    double batches;
+    
+    if (p->kind == ARRIVAL_SCHEDULE) {
+        double area = 0;
+        for (int k = 0; k + 1 < p->knot_count; k++) {
+            area += (p->knot_rate[k] + p->knot_rate[k + 1]) / 2 * (p->knot_time[k + 1] - p->knot_time[k]);
+        }
+        batches = area / p->knot_time[p->knot_count - 1];
+    } else if (p->kind == ARRIVAL_MMPP) {
+        // ǶתƽȷֲݵٰƽͣʱȨ
+        double pi[MAX_MMPP_STATES], next[MAX_MMPP_STATES];
+        for (int i = 0; i < p->state_count; i++) pi[i] = 1.0 / p->state_count;
+        for (int iter = 0; iter < 1000; iter++) {
+            for (int j = 0; j < p->state_count; j++) {
+                next[j] = 0;
+                for (int i = 0; i < p->state_count; i++) next[j] += pi[i] * p->state_jump[i][j];
+            }
+            memcpy(pi, next, sizeof(double) * p->state_count);
+        }
+        double time_weight = 0, rate_weight = 0;
+        for (int i = 0; i < p->state_count; i++) {
+            time_weight += pi[i] / p->state_leave[i];
+            rate_weight += pi[i] / p->state_leave[i] * p->state_rate[i];
+        }
+        batches = rate_weight / time_weight;
+    } else {
+        batches = p->rate;
+    }
+    return p->scale * batches * (p->batch_mean > 1 ? p->batch_mean : 1);
+}
+
+// Ԥѹʱ䵥λӣһӪҵ480ӣ
+#define ARRIVAL_PRESETS 5
+
+void preset_arrival_process(ArrivalProcess* p, int preset) {
+    memset(p, 0, sizeof(ArrivalProcess));
+    p->scale = 1.0;
+    p->batch_mean = 1.0;
+    
+    if (preset == 1 || preset == 4) {
+        // ߷壺1112㵽13ﵽƽյ4
+        const double times[] = {0, 90, 150, 180, 240, 300, 390, 480};
+        const double rates[] = {1.0, 1.2, 3.0, 4.0, 4.0, 1.5, 1.8, 1.0};
+        p->kind = ARRIVAL_SCHEDULE;
+        p->knot_count = 8;
+        memcpy(p->knot_time, times, sizeof(times));
+        memcpy(p->knot_rate, rates, sizeof(rates));
+        strcpy(p->name, "߷");
+        if (preset == 4) {
+            // ߷壺ʼ룬ÿƽ2ˣܵʲ
+            p->scale = 0.5;
+            p->batch_mean = 2.0;
+            strcpy(p->name, "߷+");
+        }
+    } else if (preset == 2) {
+        // нգƽʱÿ1.5ˣƽÿ60ӳһԼ15ӵͻÿ5ˣ
+        p->kind = ARRIVAL_MMPP;
+        p->state_count = 2;
+        p->state_rate[0] = 1.5;
+        p->state_rate[1] = 5.0;
+        p->state_leave[0] = 1 / 60.0;
+        p->state_leave[1] = 1 / 15.0;
+        p->state_jump[0][1] = 1.0;
+        p->state_jump[1][0] = 1.0;
+        strcpy(p->name, "нͻ");
+    } else if (preset == 3) {
+        // 嵽ÿ0.8ÿƽ2.5
+        p->kind = ARRIVAL_POISSON;
+        p->rate = 0.8;
+        p->batch_mean = 2.5;
+        strcpy(p->name, "嵽");
+    } else {
+        p->kind = ARRIVAL_POISSON;
+        p->rate = 2.0;
+        strcpy(p->name, "ƽȲ");
+    }
+    reset_arrival_process(p);
+}
+
+// ==================== ͻɺ ====================
+// ɵ i ͻʱ previous_arrival ֮
+void generate_customer(int i, double previous_arrival) {
+    double arrival_rate = params.arrival_rate; // Ĭƽÿӵ2ͻ
+    double service_rate = params.service_rate; // Ĭ3.0
+    bool class_streams = workload_model != NULL && workload_model->interarrival[0] != NULL;
+    
+    if (class_streams) {
+        // ͻԵĵʱ鲢
+        customers[i].type = class_next_arrival[1] < class_next_arrival[0] ? 1 : 0;
+    } else {
+        customers[i].type = (rand() % 100 < 30) ? 1 : 0; // 30%ȿͻ
+    }
+    customers[i].vip_level = customers[i].type == 1 ? (rand() % 3 + 1) : 0;
+    customers[i].business = params.business_types > 1 ? rand() % params.business_types : 0;
+    
+    memset(customers[i].arrival_grad, 0, sizeof(customers[i].arrival_grad));
+    memset(customers[i].service_grad, 0, sizeof(customers[i].service_grad));
+    memset(customers[i].wait_grad, 0, sizeof(customers[i].wait_grad));
+    
+    double random_value;
+    if (class_streams) {
+        int cls = customers[i].type;
+        customers[i].arrival_time = class_next_arrival[cls];
+        class_next_arrival[cls] += sample_distribution(workload_model->interarrival[cls]);
+    } else if (arrival_process != NULL) {
+        customers[i].arrival_time = next_arrival_time(arrival_process);
+    } else {
+        // ֲָɵ
+        random_value = (rand() % 9000 + 1000) / 10000.0; // 0.1-1.0֮
+        double interarrival = -log(random_value) / arrival_rate;
+        customers[i].arrival_time = previous_arrival + interarrival;
+        // ʱǸ֮ͣ뵽ʳɷ
+        customers[i].arrival_grad[GRAD_ARRIVAL_RATE] = -customers[i].arrival_time / arrival_rate;
+    }
+    
+    Distribution* service_dist = workload_model != NULL ?
+        workload_model->service[customers[i].business][customers[i].vip_level] : NULL;
+    if (service_dist != NULL) {
+        customers[i].service_time = sample_distribution(service_dist);
+    } else {
         // ֲָɷʱ
         random_value = (rand() % 9000 + 1000) / 10000.0; // 0.1-1.0֮
         customers[i].service_time = -log(random_value) / service_rate;
         
-        // Ʒʱ䷶Χ
-        if (customers[i].service_time < 0.5) customers[i].service_time = 0.5;
-        if (customers[i].service_time > 10) customers[i].service_time = 10;
+        // ʱʳɷ
+        customers[i].service_grad[GRAD_SERVICE_RATE] = -customers[i].service_time / service_rate;
         
-        customers[i].start_time = 0;
-        customers[i].finish_time = 0;
-        customers[i].waiting_time = 0;
-        customers[i].served_by = -1;
+        // Ʒʱ䷶ΧضʱΪ0
+        if (customers[i].service_time < 0.5) {
+            customers[i].service_time = 0.5;
+            customers[i].service_grad[GRAD_SERVICE_RATE] = 0;
+        }
+        if (customers[i].service_time > 10) {
+            customers[i].service_time = 10;
+            customers[i].service_grad[GRAD_SERVICE_RATE] = 0;
+        }
+    }
+    
+    // ֲָʱ
+    customers[i].patience = 0;
+    if (params.mean_patience > 0) {
+        random_value = (rand() % 9000 + 1000) / 10000.0;
+        customers[i].patience = -log(random_value) * params.mean_patience;
+    }
+    customers[i].abandoned = ABANDON_NONE;
+    
+    customers[i].start_time = 0;
+    customers[i].finish_time = 0;
+    customers[i].waiting_time = 0;
+    customers[i].served_by = -1;
+}
+
+void generate_customers_random(int count, int seed) {
+    srand(seed);
+    reset_workload_streams();
+    if (arrival_process != NULL) {
+        reset_arrival_process(arrival_process);
+        if (isinf(arrival_process->time)) {
+            printf("棺 %s ĲϷȫΪ0ڵʱ̲\n",
+                   arrival_process->name);
+        }
+    }
+    params.customer_count = count > MAX_CUSTOMERS ? MAX_CUSTOMERS : count;
+    
+    for (int i = 0; i < params.customer_count; i++) {
+        customers[i].id = next_customer_id++;
+        generate_customer(i, i == 0 ? 0 : customers[i-1].arrival_time);
     }
+    arrivals_truncated = count >= MAX_CUSTOMERS && params.customer_count > 0 &&
+                         customers[params.customer_count - 1].arrival_time < params.simulation_time;
 }
 
 void generate_customers_from_input() {
@@ -574,6 +2170,16 @@ void generate_customers_from_input() {
         }
         
         customers[i].vip_level = 0;
+        customers[i].business = 0;
+        customers[i].patience = 0;
+        if (params.mean_patience > 0) {
+            double random_value = (rand() % 9000 + 1000) / 10000.0;
+            customers[i].patience = -log(random_value) * params.mean_patience;
+        }
+        customers[i].abandoned = ABANDON_NONE;
+        memset(customers[i].arrival_grad, 0, sizeof(customers[i].arrival_grad));
+        memset(customers[i].service_grad, 0, sizeof(customers[i].service_grad));
+        memset(customers[i].wait_grad, 0, sizeof(customers[i].wait_grad));
         customers[i].start_time = 0;
         customers[i].finish_time = 0;
         customers[i].waiting_time = 0;
@@ -597,6 +2203,12 @@ void set_default_parameters() {
     params.priority_ratio = 0.7;
     params.simulation_time = 480; // 8Сʱ
     params.customer_count = 50;
+    params.business_types = 1;
+    params.balk_threshold = 0;
+    params.mean_patience = 0;
+    params.arrival_rate = 2.0;
+    params.service_rate = 3.0;
+    memset(window_skills, 0, sizeof(window_skills));
 }
 
 void set_custom_parameters() {
@@ -634,6 +2246,12 @@ void set_custom_parameters() {
     printf("ʱ (, 60-1440): ");
     scanf("%d", &params.simulation_time);
     
+    printf("ܾŶֵ (Ŷﵽֵʱ¿ͻ뿪, 0-): ");
+    scanf("%d", &params.balk_threshold);
+    
+    printf("ƽʱ (, ʱδ뿪, 0-): ");
+    scanf("%lf", &params.mean_patience);
+    
     printf("¼¼־? (1-, 0-): ");
     int log_choice;
     scanf("%d", &log_choice);
@@ -691,99 +2309,2503 @@ void free_queue_memory(Queue* q) {
     }
 }
 
-// ==================== ģͶԱȺ ====================
-void model_comparison() {
-    printf("\n");
-    print_separator(50, '*');
-    printf("ŶģͶԱȲ\n");
-    print_separator(50, '*');
-    
-    // ԭʼ
-    SimulationParams original_params = params;
-    bool original_log_events = log_events;
-    
-    printf("\nʹͬ30ͻݣ1001\n");
-    
-    // 1: еģ
-    printf("\n1. еģͲԣ\n");
-    for (int i = 0; i < 40; i++) printf("-");
-    printf("\n");
-    
-    params.initial_windows = 1;
+void free_all_queues() {
+    for (int b = 0; b < MAX_BUSINESS_TYPES; b++) {
+        free_queue_memory(&priority_queue[b]);
+        free_queue_memory(&normal_queue[b]);
+    }
+    memset(queue_nodes, 0, sizeof(queue_nodes));
+    waiting_mask[0] = waiting_mask[1] = 0;
+    waiting_total = 0;
+}
+
+// ==================== 溯 ====================
+// ԳΪĽ棺ɷڼáɵĿͻժҪϣɣ
+// ¼ Statisticsȴʱֱͼļֻ׷ӣд߼һд¼
+// ¼ĩβУͣӳļ󲻼ȡУͲĩ¼δд꣬ͣڴˣ
+// ֮δʱټļǷ䳤ݵ𻵼¼
+// д߳ʱȽصµĲ¼Լд벻ʱҲ˻ԭȣ
+// һжϵд벻ʹ֮ļ¼޷ȡ
+#define CACHE_FILE_NAME "bank_results.cache"
+#define CACHE_MAGIC 0x43525142u     // "BQRC"
+#define CACHE_VERSION 3             // ¼ʽ仯ʱ1
+#define CACHE_KEY_BASIS 0x84222325cbf29ce4ULL  // ڶϣĳֵ
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int record_size;       // ¼ȣ MAX_WINDOWS ȱѡ仯
+    unsigned int reserved;
+} CacheHeader;
+
+typedef struct {
+    unsigned long long key[2];      // 64λϣ
+    Statistics stats;
+    double end_time;                // ʱ
+    unsigned long long event_digest;
+    int event_count;
+    unsigned long long checksum;    // ݵУͣһֶ
+} CacheRecord;
+
+typedef struct {
+#ifdef CACHE_NO_MMAP
+    FILE* file;
+    unsigned char* map;             // ļݵĸ
+#else
+    int fd;
+    const unsigned char* map;       // ļֻӳ
+#endif
+    size_t map_size;
+    size_t indexed_size;            // ѽļȣΪ¼
+    int* slots;                     // Ѱַϣż¼+1
+    int slot_count;                 // λ2ݣ
+    int record_count;
+    long hits;
+    long misses;
+} ResultCache;
+
+ResultCache* result_cache = NULL;   // Ѵ򿪵Ľ棨ΪNULLʱʹû棩
+
+unsigned long long cache_record_checksum(const CacheRecord* record) {
+    return digest_bytes(DIGEST_OFFSET_BASIS, record, offsetof(CacheRecord, checksum));
+}
+
+// ǰļɿͻ֮
+void scenario_key(int seed, unsigned long long key[2]) {
+    unsigned long long workload = DIGEST_OFFSET_BASIS;
+    for (int i = 0; i < params.customer_count; i++) {
+        workload = digest_bytes(workload, &customers[i].arrival_time, sizeof(double));
+        workload = digest_bytes(workload, &customers[i].service_time, sizeof(double));
+        workload = digest_bytes(workload, &customers[i].patience, sizeof(double));
+        workload = digest_bytes(workload, &customers[i].type, sizeof(int));
+        workload = digest_bytes(workload, &customers[i].business, sizeof(int));
+        workload = digest_bytes(workload, &customers[i].vip_level, sizeof(int));
+    }
+    
+    // ֶβ룬ṹֽӰ
+    int version = CACHE_VERSION, gradients = gradient_estimation;
+    int int_fields[] = {params.initial_windows, params.max_windows, params.min_windows,
+                        params.open_threshold, params.close_threshold, params.simulation_time,
+                        params.customer_count, params.business_types, params.balk_threshold,
+                        version, gradients, seed};
+    double double_fields[] = {params.priority_ratio, params.mean_patience,
+                              params.arrival_rate, params.service_rate};
+    unsigned long long bases[2] = {DIGEST_OFFSET_BASIS, CACHE_KEY_BASIS};
+    for (int k = 0; k < 2; k++) {
+        unsigned long long h = bases[k];
+        h = digest_bytes(h, int_fields, sizeof(int_fields));
+        h = digest_bytes(h, double_fields, sizeof(double_fields));
+        h = digest_bytes(h, window_skills, sizeof(window_skills));
+        h = digest_bytes(h, &workload, sizeof(workload));
+        key[k] = h;
+    }
+}
+
+void cache_index_insert(ResultCache* cache, const unsigned long long key[2], int record) {
+    if ((cache->record_count + 1) * 2 > cache->slot_count) {
+        // ݲ²м¼
+        int old_count = cache->slot_count;
+        int* old_slots = cache->slots;
+        cache->slot_count = old_count > 0 ? old_count * 2 : 1024;
+        cache->slots = (int*)calloc(cache->slot_count, sizeof(int));
+        cache->record_count = 0;
+        for (int i = 0; i < old_count; i++) {
+            if (old_slots[i] != 0) {
+                const CacheRecord* r = (const CacheRecord*)(cache->map + sizeof(CacheHeader) +
+                                                            (size_t)(old_slots[i] - 1) * sizeof(CacheRecord));
+                cache_index_insert(cache, r->key, old_slots[i] - 1);
+            }
+        }
+        free(old_slots);
+    }
+    
+    int mask = cache->slot_count - 1;
+    int i = (int)(key[0] & mask);
+    while (cache->slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    cache->slots[i] = record + 1;
+    cache->record_count++;
+}
+
+// ӳļΪ¼
+void cache_refresh(ResultCache* cache) {
+#ifdef CACHE_NO_MMAP
+    fseek(cache->file, 0, SEEK_END);
+    size_t size = (size_t)ftell(cache->file);
+    if (size <= cache->map_size) return;
+    cache->map = (unsigned char*)realloc(cache->map, size);
+    fseek(cache->file, 0, SEEK_SET);
+    size = fread(cache->map, 1, size, cache->file);
+#else
+    struct stat st;
+    if (fstat(cache->fd, &st) != 0 || (size_t)st.st_size <= cache->map_size) return;
+    size_t size = (size_t)st.st_size;
+    if (cache->map != NULL) {
+        munmap((void*)cache->map, cache->map_size);
+    }
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, cache->fd, 0);
+    if (map == MAP_FAILED) {
+        cache->map = NULL;
+        cache->map_size = 0;
+        cache->indexed_size = sizeof(CacheHeader);
+        cache->record_count = 0;
+        memset(cache->slots, 0, sizeof(int) * cache->slot_count);
+        return;
+    }
+    cache->map = (const unsigned char*)map;
+#endif
+    cache->map_size = size;
+    
+    while (cache->indexed_size + sizeof(CacheRecord) <= cache->map_size) {
+        const CacheRecord* r = (const CacheRecord*)(cache->map + cache->indexed_size);
+        if (r->checksum == cache_record_checksum(r)) {
+            int record = (int)((cache->indexed_size - sizeof(CacheHeader)) / sizeof(CacheRecord));
+            cache_index_insert(cache, r->key, record);
+        } else if (cache->indexed_size + sizeof(CacheRecord) == cache->map_size) {
+            break; // δд
+        }
+        cache->indexed_size += sizeof(CacheRecord);
+    }
+}
+
+const CacheRecord* cache_find(const ResultCache* cache, const unsigned long long key[2]) {
+    if (cache->slot_count == 0) return NULL;
+    int mask = cache->slot_count - 1;
+    for (int i = (int)(key[0] & mask); cache->slots[i] != 0; i = (i + 1) & mask) {
+        const CacheRecord* r = (const CacheRecord*)(cache->map + sizeof(CacheHeader) +
+                                                    (size_t)(cache->slots[i] - 1) * sizeof(CacheRecord));
+        if (r->key[0] == key[0] && r->key[1] == key[1]) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+bool cache_lookup(ResultCache* cache, const unsigned long long key[2], CacheRecord* out) {
+    const CacheRecord* r = cache_find(cache, key);
+    if (r == NULL) {
+        // ܸ̿׷˼¼
+        cache_refresh(cache);
+        r = cache_find(cache, key);
+    }
+    if (r == NULL) return false;
+    memcpy(out, r, sizeof(CacheRecord));
+    return true;
+}
+
+// д֮
+void cache_lock(ResultCache* cache, bool lock) {
+#ifdef CACHE_NO_MMAP
+#ifdef _WIN32
+    fseek(cache->file, 0, SEEK_SET);
+    _locking(_fileno(cache->file), lock ? _LK_LOCK : _LK_UNLCK, 1);
+#else
+    flock(fileno(cache->file), lock ? LOCK_EX : LOCK_UN);
+#endif
+#else
+    flock(cache->fd, lock ? LOCK_EX : LOCK_UN);
+#endif
+}
+
+#ifdef CACHE_NO_MMAP
+bool cache_truncate(ResultCache* cache, long size) {
+#ifdef _WIN32
+    return _chsize(_fileno(cache->file), size) == 0;
+#else
+    return ftruncate(fileno(cache->file), (off_t)size) == 0;
+#endif
+}
+#endif
+
+void cache_append(ResultCache* cache, CacheRecord* record) {
+    bool ok;
+    
+    record->checksum = cache_record_checksum(record);
+    cache_lock(cache, true);
+#ifdef CACHE_NO_MMAP
+    fseek(cache->file, 0, SEEK_END);
+    long end = ftell(cache->file);
+    long partial = (end - (long)sizeof(CacheHeader)) % (long)sizeof(CacheRecord);
+    ok = end >= (long)sizeof(CacheHeader);
+    if (ok && partial != 0) {
+        end -= partial;
+        ok = cache_truncate(cache, end);
+    }
+    if (ok) {
+        ok = fwrite(record, sizeof(CacheRecord), 1, cache->file) == 1;
+        ok = fflush(cache->file) == 0 && ok;
+        if (!ok) cache_truncate(cache, end);
+    }
+#else
+    // ʱļĩβĲ¼ֻԱдߣص߲ʲļ¼
+    struct stat st;
+    ok = fstat(cache->fd, &st) == 0 && st.st_size >= (off_t)sizeof(CacheHeader);
+    if (ok) {
+        off_t end = st.st_size;
+        off_t partial = (end - (off_t)sizeof(CacheHeader)) % (off_t)sizeof(CacheRecord);
+        if (partial != 0) {
+            end -= partial;
+            ok = ftruncate(cache->fd, end) == 0;
+        }
+        if (ok) {
+            ok = write(cache->fd, record, sizeof(CacheRecord)) == (ssize_t)sizeof(CacheRecord);
+            if (!ok && ftruncate(cache->fd, end) != 0) {
+                printf("棺޷˻дǰĳ\n");
+            }
+        }
+    }
+#endif
+    cache_lock(cache, false);
+    if (!ok) {
+        printf("棺дʧ\n");
+        return;
+    }
+    cache_refresh(cache);
+}
+
+#ifndef CACHE_NO_MMAP
+// дһֻļͷļٸ滻ļ
+bool cache_replace_file(const char* path, const CacheHeader* header) {
+    char temp[512];
+    snprintf(temp, sizeof(temp), "%s.tmp.%ld", path, (long)getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, header, sizeof(CacheHeader)) == (ssize_t)sizeof(CacheHeader);
+    ok = close(fd) == 0 && ok;
+    if (ok && rename(temp, path) == 0) return true;
+    unlink(temp);
+    return false;
+}
+#endif
+
+// ȡ򴴽ļͷǻļʽͬľɻ棺ķʽֱգ
+// ӳ䷽ʽдļ滻´򿪣ض̿ӳľļ
+bool cache_check_header(ResultCache* cache, const char* path) {
+    CacheHeader header, expected = {CACHE_MAGIC, CACHE_VERSION, sizeof(CacheRecord), 0};
+    bool ok = true;
+    
+#ifdef CACHE_NO_MMAP
+    cache_lock(cache, true);
+    fseek(cache->file, 0, SEEK_SET);
+    size_t got = fread(&header, 1, sizeof(header), cache->file);
+    if (got == sizeof(header) && header.magic != CACHE_MAGIC) {
+        ok = false;
+    } else if (got != sizeof(header) || memcmp(&header, &expected, sizeof(header)) != 0) {
+        if (got > 0) printf("ʾ%s ļ¼ʽѱ仯\n", path);
+        ok = cache_truncate(cache, 0) && fwrite(&expected, sizeof(expected), 1, cache->file) == 1;
+        ok = fflush(cache->file) == 0 && ok;
+    }
+    cache_lock(cache, false);
+#else
+    for (int attempt = 0; ; attempt++) {
+        bool replaced = false;
+        flock(cache->fd, LOCK_EX);
+        ssize_t got = pread(cache->fd, &header, sizeof(header), 0);
+        if (got == (ssize_t)sizeof(header) && header.magic != CACHE_MAGIC) {
+            ok = false;
+        } else if (got == 0) {
+            ok = write(cache->fd, &expected, sizeof(expected)) == (ssize_t)sizeof(expected);
+        } else if (got != (ssize_t)sizeof(header) || memcmp(&header, &expected, sizeof(header)) != 0) {
+            printf("ʾ%s ļ¼ʽѱ仯\n", path);
+            ok = replaced = cache_replace_file(path, &expected);
+        }
+        flock(cache->fd, LOCK_UN);
+        if (!replaced) break;
+        
+        // ´滻ļٴμ飨̿ͬʱ滻
+        close(cache->fd);
+        cache->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (cache->fd < 0 || attempt == 2) {
+            ok = false;
+            break;
+        }
+    }
+#endif
+    if (!ok) {
+        printf("棺%s ǽļʹû\n", path);
+    }
+    return ok;
+}
+
+void close_result_cache(ResultCache* cache) {
+    if (cache == NULL) return;
+#ifdef CACHE_NO_MMAP
+    if (cache->file != NULL) fclose(cache->file);
+    free(cache->map);
+#else
+    if (cache->map != NULL) munmap((void*)cache->map, cache->map_size);
+    close(cache->fd);
+#endif
+    free(cache->slots);
+    free(cache);
+}
+
+// 򿪣Ҫʱ棬ʧʱ NULL
+ResultCache* open_result_cache(const char* path) {
+    ResultCache* cache = (ResultCache*)calloc(1, sizeof(ResultCache));
+#ifdef CACHE_NO_MMAP
+    cache->file = fopen(path, "a+b"); // ׷ӷʽÿд붼ļĩβ
+    if (cache->file == NULL) {
+        free(cache);
+        return NULL;
+    }
+#else
+    cache->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (cache->fd < 0) {
+        free(cache);
+        return NULL;
+    }
+#endif
+    if (!cache_check_header(cache, path)) {
+        close_result_cache(cache);
+        return NULL;
+    }
+    cache->indexed_size = sizeof(CacheHeader);
+    cache->slot_count = 1024;
+    cache->slots = (int*)calloc(cache->slot_count, sizeof(int));
+    cache_refresh(cache);
+    return cache;
+}
+
+// ״ʹʱĬϻļ
+ResultCache* default_result_cache() {
+    static bool tried = false;
+    if (!tried) {
+        tried = true;
+        result_cache = open_result_cache(CACHE_FILE_NAME);
+    }
+    return result_cache;
+}
+
+// ɵĿͻͳƣͬ run_simulation + calculate_statistics
+// ͬнʱֱȡءҪ¼¼켣вʹû档
+// Ƿл
+bool run_simulation_cached(int seed) {
+    ResultCache* cache = default_result_cache();
+    bool cacheable = cache != NULL && !log_events && !print_events && event_trace == NULL;
+    CacheRecord record;
+    
+    if (cacheable) {
+        scenario_key(seed, record.key);
+        if (cache_lookup(cache, record.key, &record)) {
+            stats = record.stats;
+            current_time = record.end_time;
+            event_digest = record.event_digest;
+            event_count = record.event_count;
+            cache->hits++;
+            return true;
+        }
+        cache->misses++;
+    }
+    
+    current_time = 0;
+    run_simulation();
+    calculate_statistics();
+    
+    if (cacheable) {
+        unsigned long long key[2] = {record.key[0], record.key[1]};
+        memset(&record, 0, sizeof(record));
+        record.key[0] = key[0];
+        record.key[1] = key[1];
+        record.stats = stats;
+        record.end_time = current_time;
+        record.event_digest = event_digest;
+        record.event_count = event_count;
+        cache_append(cache, &record);
+    }
+    return false;
+}
+
+// ͬ run_replication()ɽ
+bool cached_replication(int count, int seed) {
+    next_customer_id = 1;
+    generate_customers_random(count, seed);
+    bool hit = run_simulation_cached(seed);
+    free_all_queues();
+    return hit;
+}
+
+void print_wait_histogram(const Statistics* s) {
+    int peak = 1;
+    for (int cls = 0; cls < 2; cls++) {
+        for (int k = 0; k < WAIT_HIST_BINS; k++) {
+            if (s->wait_histogram[cls][k] > peak) peak = s->wait_histogram[cls][k];
+        }
+    }
+    for (int cls = 0; cls < 2; cls++) {
+        printf("%sͻȴʱֲ:\n", cls == 1 ? "" : "ͨ");
+        int last = 0;
+        for (int k = 0; k < WAIT_HIST_BINS; k++) {
+            if (s->wait_histogram[cls][k] > 0) last = k;
+        }
+        for (int k = 0; k <= last; k++) {
+            printf("  %5.1f%s %4d ", k * WAIT_HIST_WIDTH, k == WAIT_HIST_BINS - 1 ? "+ " : "~ ",
+                   s->wait_histogram[cls][k]);
+            for (int j = 0; j < s->wait_histogram[cls][k] * 40 / peak; j++) printf("#");
+            printf("\n");
+        }
+    }
+}
+
+// صĲɨ裺ڶһͬĳֱȡԻ
+void result_cache_mode() {
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    bool original_print_events = print_events;
+    const int count = 300, seeds = 10;
+    const double ratios[] = {0.5, 0.7, 0.9};
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("\n");
+    print_separator(50, '*');
+    
+    clock_t begin = clock();
+    ResultCache* cache = default_result_cache();
+    if (cache == NULL) {
+        printf("޷򿪽 %s\n", CACHE_FILE_NAME);
+        return;
+    }
+    printf("ļ %s: %d ¼, %.1f KB, 򿪲ʱ %.3f \n", CACHE_FILE_NAME,
+           cache->record_count, cache->map_size / 1024.0, (double)(clock() - begin) * 1000 / CLOCKS_PER_SEC);
+    
+    log_events = false;
+    print_events = false;
+    params.business_types = 1;
+    params.balk_threshold = 0;
+    params.mean_patience = 0;
+    
+    printf("\n%-6s %-10s %-8s %-8s %-14s %-14s\n", "ִ", "", "", "δ", "(΢/)", "(΢/)");
+    for (int round = 0; round < 2; round++) {
+        int first = round == 0 ? 1 : 2, last = round == 0 ? 4 : 5;
+        long hits = 0, misses = 0;
+        double hit_seconds = 0, miss_seconds = 0;
+        
+        for (int w = first; w <= last; w++) {
+            for (int k = 0; k < 3; k++) {
+                for (int seed = 1; seed <= seeds; seed++) {
+                    params.initial_windows = params.min_windows = params.max_windows = w;
+                    params.priority_ratio = ratios[k];
+                    clock_t run_begin = clock();
+                    bool hit = cached_replication(count, 7000 + seed);
+                    double seconds = (double)(clock() - run_begin) / CLOCKS_PER_SEC;
+                    if (hit) {
+                        hits++;
+                        hit_seconds += seconds;
+                    } else {
+                        misses++;
+                        miss_seconds += seconds;
+                    }
+                }
+            }
+        }
+        printf("%-6d %d-%-8d %-8ld %-8ld %-14.1f %-14.1f\n", round + 1, first, last, hits, misses,
+               hits > 0 ? hit_seconds * 1e6 / hits : 0.0, misses > 0 ? miss_seconds * 1e6 / misses : 0.0);
+    }
+    printf("ʱɿͻ㳡\n");
+    
+    // ȡһչʾбֱͼ
+    params.initial_windows = params.min_windows = params.max_windows = 2;
+    params.priority_ratio = 0.7;
+    bool hit = cached_replication(count, 7001);
+    printf("\n2 , ȱ 0.7,  7001 (%s):\n", hit ? "Ի" : "·");
+    printf("ƽȴ: ͨ %.2f ,  %.2f , ¼ժҪ %016llx\n",
+           stats.avg_wait_time[0], stats.avg_wait_time[1], event_digest);
+    print_wait_histogram(&stats);
+    printf("\nۼ:  %ld , δ %ld , 湲 %d ¼\n", cache->hits, cache->misses, cache->record_count);
+    
+    params = original_params;
+    log_events = original_log_events;
+    print_events = original_print_events;
+}
+
+// ==================== ģͶԱȺ ====================
+void model_comparison() {
+    printf("\n");
+    print_separator(50, '*');
+    printf("ŶģͶԱȲ\n");
+    print_separator(50, '*');
+    
+    // ԭʼ
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    
+    printf("\nʹͬ30ͻݣ1001\n");
+    
+    // 1: еģ
+    printf("\n1. еģͲԣ\n");
+    for (int i = 0; i < 40; i++) printf("-");
+    printf("\n");
+    
+    params.initial_windows = 1;
     params.max_windows = 1;
     params.min_windows = 1;
     params.priority_ratio = 0.0; // ʹȼ
     log_events = false; // ¼ϸ־
     
-    generate_customers_random(30, 1001);
-    current_time = 0;
-    run_simulation();
-    calculate_statistics();
+    generate_customers_random(30, 1001);
+    current_time = 0;
+    run_simulation();
+    calculate_statistics();
+    
+    double single_avg_wait = (stats.avg_wait_time[0] + stats.avg_wait_time[1]) / 2;
+    printf("ƽȴʱ: %.2f\n", single_avg_wait);
+    printf(": %.2fͻ/Сʱ\n", stats.throughput);
+    
+    // նڴ
+    free_all_queues();
+    
+    // 2: еģ
+    printf("\n2. еģͲԣ\n");
+    for (int i = 0; i < 40; i++) printf("-");
+    printf("\n");
+    
+    params.initial_windows = 1;
+    params.max_windows = 1;
+    params.min_windows = 1;
+    params.priority_ratio = 0.7; // ȼ
+    params.open_threshold = 10;  // ֵЧĴڵ߼
+    params.close_threshold = 5;
+    
+    generate_customers_random(30, 1001);
+    current_time = 0;
+    init_windows(); // ³ʼ
+    run_simulation();
+    calculate_statistics();
+    
+    double multi_single_avg_wait = (stats.avg_wait_time[0] * stats.served_count[0] + 
+                                   stats.avg_wait_time[1] * stats.served_count[1]) / 
+                                   (stats.served_count[0] + stats.served_count[1]);
+    printf("ͨͻƽȴ: %.2f\n", stats.avg_wait_time[0]);
+    printf("ȿͻƽȴ: %.2f\n", stats.avg_wait_time[1]);
+    printf("Ȩƽȴ: %.2f\n", multi_single_avg_wait);
+    printf(": %.2fͻ/Сʱ\n", stats.throughput);
+    
+    // նڴ
+    free_all_queues();
+    
+    // 3: жരģ
+    printf("\n3. жരģͲԣ\n");
+    for (int i = 0; i < 40; i++) printf("-");
+    printf("\n");
+    
+    params = original_params; // ָԭʼ
+    log_events = original_log_events;
+    
+    generate_customers_random(30, 1001);
+    current_time = 0;
+    init_windows(); // ³ʼ
+    run_simulation();
+    calculate_statistics();
+    
+    double multi_multi_avg_wait = (stats.avg_wait_time[0] * stats.served_count[0] + 
+                                  stats.avg_wait_time[1] * stats.served_count[1]) / 
+                                  (stats.served_count[0] + stats.served_count[1]);
+    printf("ͨͻƽȴ: %.2f\n", stats.avg_wait_time[0]);
+    printf("ȿͻƽȴ: %.2f\n", stats.avg_wait_time[1]);
+    printf("Ȩƽȴ: %.2f\n", multi_multi_avg_wait);
+    printf(": %.2fͻ/Сʱ\n", stats.throughput);
+    
+    printf("\nģͶԱܽ᣺\n");
+    printf("- еڣ򵥹ƽЧͣƽȴ: %.2fӣ\n", single_avg_wait);
+    printf("- еڣȿͻãͨͻܵȴʱ䳤Ȩƽ: %.2fӣ\n", multi_single_avg_wait);
+    printf("- жരڣۺãԴʸߣȨƽ: %.2fӣ\n", multi_multi_avg_wait);
+}
+
+// ==================== ༼ܴʾ ====================
+// 㲼֣ͨԱֻҵŴ̨
+#define SKILL_PERSONAL 0
+#define SKILL_LOAN     1
+#define SKILL_FOREX    2
+
+void skill_demo_mode() {
+    SimulationParams original_params = params;
+    bool original_print_events = print_events;
+    const char* business_names[] = {"ҵ", "", ""};
+    const char* window_roles[] = {"Ա", "Ա", "Ա", "Ա", "Ŵ", "Ŵ", "̨", "ۺϹ̨"};
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("༼ܴʾҵ//㣩\n");
+    print_separator(50, '*');
+    
+    params.initial_windows = 6;
+    params.max_windows = 8;
+    params.min_windows = 4;
+    params.open_threshold = 6;
+    params.close_threshold = 2;
+    params.priority_ratio = 0.7;
+    params.simulation_time = 480;
+    params.business_types = 3;
+    
+    memset(window_skills, 0, sizeof(window_skills));
+    for (int i = 0; i < 4; i++) {
+        window_skills[i] = 1ULL << SKILL_PERSONAL;
+    }
+    window_skills[4] = window_skills[5] = (1ULL << SKILL_PERSONAL) | (1ULL << SKILL_LOAN);
+    window_skills[6] = (1ULL << SKILL_PERSONAL) | (1ULL << SKILL_FOREX);
+    window_skills[7] = 0; // ȫܴ
+    
+    printf("\nã\n");
+    for (int i = 0; i < params.max_windows; i++) {
+        printf(" %d (%s):", i, window_roles[i]);
+        SkillMask skills = window_skills[i] == 0 ? ALL_SKILLS(params.business_types) : window_skills[i];
+        for (int b = 0; b < params.business_types; b++) {
+            if (skills & (1ULL << b)) printf(" %s", business_names[b]);
+        }
+        printf("%s\n", i < params.initial_windows ? "" : " ()");
+    }
+    
+    generate_customers_random(400, 2024);
+    print_events = false;
+    current_time = 0;
+    run_simulation();
+    calculate_statistics();
+    print_statistics();
+    
+    printf("\nҵգ");
+    for (int b = 0; b < params.business_types; b++) {
+        printf(" %d-%s", b, business_names[b]);
+    }
+    printf("\n");
+    
+    free_all_queues();
+    params = original_params;
+    print_events = original_print_events;
+    memset(window_skills, 0, sizeof(window_skills));
+}
+
+// ==================== ݶȹƺ ====================
+// ɿͻһη棨ͳƽ stats У
+void run_replication(int count, int seed) {
+    next_customer_id = 1;
+    generate_customers_random(count, seed);
+    current_time = 0;
+    run_simulation();
+    calculate_statistics();
+    free_all_queues();
+}
+
+void gradient_mode() {
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    bool original_print_events = print_events;
+    const int count = 700, seed = 2025;
+    double ipa[2][GRAD_PARAMS], half[2][GRAD_PARAMS];
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("ݶȹƣСŶ\n");
+    print_separator(50, '*');
+    
+    params.initial_windows = 1;
+    params.max_windows = 1;
+    params.min_windows = 1;
+    params.priority_ratio = 0.7;
+    params.simulation_time = 480;
+    params.arrival_rate = 1.5;
+    log_events = false;
+    print_events = false;
+    
+    if (!gradient_supported()) {
+        printf("ǰò֧IPAݶȹƣرվܾŶ;뿪Ҳʹùģͻ򵽴̣\n");
+        params = original_params;
+        log_events = original_log_events;
+        print_events = original_print_events;
+        return;
+    }
+    
+    printf(",  %.2f,  %.2f, ͻ %d,  %d\n",
+           params.arrival_rate, params.service_rate, count, seed);
+    
+    gradient_estimation = true;
+    run_replication(count, seed);
+    gradient_estimation = false;
+    memcpy(ipa, stats.wait_grad, sizeof(ipa));
+    memcpy(half, stats.wait_grad_half, sizeof(half));
+    
+    // µĲΪգ㹻С¼˳򲻱ʱӦIPAһ£ɽ
+    double fd[2][GRAD_PARAMS];
+    for (int k = 0; k < GRAD_PARAMS; k++) {
+        double* rate = k == GRAD_SERVICE_RATE ? &params.service_rate : &params.arrival_rate;
+        double base = *rate, h = base * 1e-7;
+        double plus[2], minus[2];
+        
+        *rate = base + h;
+        cached_replication(count, seed);
+        plus[0] = stats.avg_wait_time[0];
+        plus[1] = stats.avg_wait_time[1];
+        *rate = base - h;
+        cached_replication(count, seed);
+        minus[0] = stats.avg_wait_time[0];
+        minus[1] = stats.avg_wait_time[1];
+        *rate = base;
+        
+        fd[0][k] = (plus[0] - minus[0]) / (2 * h);
+        fd[1][k] = (plus[1] - minus[1]) / (2 * h);
+    }
+    
+    const char* class_names[] = {"ͨͻ", "ȿͻ"};
+    for (int cls = 0; cls < 2; cls++) {
+        printf("\n%s:\n", class_names[cls]);
+        printf("  dƽȴ/d: IPA %.4f  %.4f, ޲ %.4f\n",
+               ipa[cls][GRAD_SERVICE_RATE], half[cls][GRAD_SERVICE_RATE], fd[cls][GRAD_SERVICE_RATE]);
+        printf("  dƽȴ/d: IPA %.4f  %.4f, ޲ %.4f\n",
+               ipa[cls][GRAD_ARRIVAL_RATE], half[cls][GRAD_ARRIVAL_RATE], fd[cls][GRAD_ARRIVAL_RATE]);
+    }
+    
+    params = original_params;
+    log_events = original_log_events;
+    print_events = original_print_events;
+}
+
+// ==================== ϡ¼ƺˮƽѣ ====================
+// ̶ѣÿһһˮƽʱ״̬¡ effort 켣
+// δĿͻɵ޼Դӿ¡ʱ³
+// ȿͻȴҪԺΪŶõȿͻѵȴʱԽˮƽʱ̿¼֮䣩
+// һͻȴֵ֮ǰһʱԽˮƽĩԽˮƽ״̬е
+// ͳƵȴֵȿͻȿͻβ P(W>T) = E[]/E[]
+// ŶҪԺŶƵŶﵽֵĸʣ֮
+#define RARE_PRIORITY_WAIT 0    // ȿͻȴʱ䳬ֵͻƣ
+#define RARE_QUEUE_LENGTH  1    // Ŷﵽֵƣ
+#define MAX_SPLIT_LEVELS 32
+#define RARE_NORMALIZE_DAYS 50  // ÿȿͻ
+
+// ʱķ״̬
+typedef struct {
+    double time;
+    int active_windows;
+    int next_arrival;           // һδĿͻ±
+    Window windows[MAX_WINDOWS];
+    int waiting_count;
+    Customer* waiting;          // ŶеĿͻȶǰڱ˳
+} SplitState;
+
+long rare_event_steps;          // ϡ¼ۼƴ¼
+
+void capture_state(SplitState* state) {
+    int n = 0;
+    
+    state->time = current_time;
+    state->active_windows = active_windows;
+    memcpy(state->windows, windows, sizeof(windows));
+    state->next_arrival = params.customer_count;
+    for (int i = 0; i < params.customer_count; i++) {
+        if (is_event_scheduled(&event_heap, ARRIVAL_SLOT(i))) {
+            state->next_arrival = i;
+            break;
+        }
+    }
+    
+    state->waiting_count = waiting_total;
+    state->waiting = (Customer*)malloc(sizeof(Customer) * (waiting_total > 0 ? waiting_total : 1));
+    for (int cls = 1; cls >= 0; cls--) {
+        for (int b = 0; b < params.business_types; b++) {
+            Queue* q = cls == 1 ? &priority_queue[b] : &normal_queue[b];
+            for (Node* node = q->front; node != NULL; node = node->next) {
+                state->waiting[n++] = node->customer;
+            }
+        }
+    }
+}
+
+void release_state(SplitState* state) {
+    free(state->waiting);
+    state->waiting = NULL;
+}
+
+// ӱ״̬棬δĿͻµ
+void restore_state(const SplitState* state, int seed) {
+    free_all_queues();
+    init_all_queues();
+    init_event_heap(&event_heap, EVENT_SLOTS);
+    
+    current_time = state->time;
+    active_windows = state->active_windows;
+    memcpy(windows, state->windows, sizeof(windows));
+    rebuild_window_maps();
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        if (windows[i].is_busy) {
+            schedule_event(&event_heap, FINISH_SLOT(i), windows[i].busy_start + windows[i].current_customer.service_time);
+        }
+    }
+    for (int k = 0; k < state->waiting_count; k++) {
+        Customer customer = state->waiting[k];
+        customers[customer.id - 1] = customer;
+        enqueue_customer(customer);
+    }
+    
+    srand(seed);
+    double t = current_time;
+    for (int i = state->next_arrival; i < params.customer_count; i++) {
+        customers[i].id = i + 1;
+        generate_customer(i, t);
+        t = customers[i].arrival_time;
+        schedule_event(&event_heap, ARRIVAL_SLOT(i), t);
+    }
+}
+
+double oldest_priority_arrival() {
+    double oldest = -1;
+    SkillMask mask = waiting_mask[1];
+    while (mask) {
+        int b = lowest_bit(mask);
+        mask &= mask - 1;
+        double arrival = priority_queue[b].front->customer.arrival_time;
+        if (oldest < 0 || arrival < oldest) oldest = arrival;
+    }
+    return oldest;
+}
+
+// Ŷõȿͻһ¼֮ǰӪҵʱڣѵȴʱǷﵽ level
+// ﵽʱʱƽԽˮƽʱ
+bool priority_wait_reaches(double level) {
+    double oldest = oldest_priority_arrival();
+    if (oldest < 0 || current_time >= params.simulation_time) return false;
+    
+    double crossing = oldest + level;
+    if (crossing <= current_time) return true;
+    double horizon = params.simulation_time;
+    int slot = peek_next_event(&event_heap);
+    if (slot != -1 && event_heap.time[slot] < horizon) horizon = event_heap.time[slot];
+    if (crossing >= horizon) return false;
+    current_time = crossing;
+    return true;
+}
+
+// ƽֱҪԺﵽ levelﷵtrue
+bool run_until_level(double level, int mode) {
+    while (true) {
+        if (mode == RARE_QUEUE_LENGTH ? waiting_total >= level : priority_wait_reaches(level)) {
+            return true;
+        }
+        bool more = step_simulation();
+        rare_event_steps++;
+        if (!more) return false;
+    }
+}
+
+// ͻ i ǷΪȴ target ѷȿͻȴʱֱͼĿھһ£
+bool priority_wait_exceeded(int i, double target) {
+    return customers[i].type == 1 && customers[i].finish_time > 0 && customers[i].waiting_time > target;
+}
+
+//  state еͳƵȴֵȿͻ
+// ¡ʱ֮ǰѿʼĿͻȴˮƽ©
+int count_wait_exceedances(const SplitState* state, double target) {
+    int count = 0;
+    
+    while (step_simulation()) {
+        rare_event_steps++;
+    }
+    for (int k = 0; k < state->waiting_count; k++) {
+        count += priority_wait_exceeded(state->waiting[k].id - 1, target);
+    }
+    for (int i = state->next_arrival; i < params.customer_count; i++) {
+        count += priority_wait_exceeded(i, target);
+    }
+    return count;
+}
+
+// ̶ˮƽѡŶģʽصﵽĿĸʣ
+// ȵȴģʽÿȴֵȿͻ*relative_error Ϊ
+double splitting_estimate(int mode, double target, const double* levels, int level_count,
+                          int effort, int count, int seed, double* relative_error) {
+    SplitState* current_states = (SplitState*)malloc(sizeof(SplitState) * effort);
+    SplitState* next_states = (SplitState*)malloc(sizeof(SplitState) * effort);
+    int current_count = 0;
+    double estimate = 1.0, re2 = 0;
+    
+    for (int stage = 0; stage <= level_count; stage++) {
+        bool last = stage == level_count;
+        int hits = 0;
+        double sum = 0, sum2 = 0;
+        
+        for (int j = 0; j < effort; j++) {
+            const SplitState* from = stage > 0 ? &current_states[j % current_count] : NULL;
+            if (stage == 0) {
+                free_all_queues();
+                next_customer_id = 1;
+                generate_customers_random(count, seed + j);
+                current_time = 0;
+                start_simulation();
+            } else {
+                restore_state(from, seed + stage * effort + j);
+            }
+            
+            double value;
+            if (last && mode == RARE_PRIORITY_WAIT) {
+                value = count_wait_exceedances(from, target);
+            } else {
+                value = run_until_level(last ? target : levels[stage], mode);
+                if (value > 0 && !last) {
+                    capture_state(&next_states[hits]);
+                }
+            }
+            hits += value > 0;
+            sum += value;
+            sum2 += value * value;
+        }
+        free_all_queues();
+        
+        double mean = sum / effort;
+        if (!last) {
+            printf(" %d  (%s %g):  %.4f (%d/%d)\n", stage + 1,
+                   mode == RARE_PRIORITY_WAIT ? "ȿͻѵȴ()" : "Ŷ", levels[stage],
+                   mean, hits, effort);
+        } else if (mode == RARE_PRIORITY_WAIT) {
+            printf(" %d  (): ƽ޿ͻ %.4f  (%d/%d 켣г)\n",
+                   stage + 1, mean, hits, effort);
+        } else {
+            printf(" %d  (Ŀ %g):  %.4f (%d/%d)\n", stage + 1, target, mean, hits, effort);
+        }
+        
+        for (int j = 0; j < current_count; j++) {
+            release_state(&current_states[j]);
+        }
+        SplitState* swap = current_states;
+        current_states = next_states;
+        next_states = swap;
+        current_count = last ? 0 : hits;
+        
+        estimate *= mean;
+        if (hits == 0) {
+            estimate = 0;
+            re2 = 0;
+            break;
+        }
+        // ԷΪŬĩ
+        double variance = sum2 / effort - mean * mean;
+        if (variance < 0) variance = 0;
+        re2 += variance / (effort * mean * mean);
+    }
+    
+    for (int j = 0; j < current_count; j++) {
+        release_state(&current_states[j]);
+    }
+    free(current_states);
+    free(next_states);
+    *relative_error = sqrt(re2);
+    return estimate;
+}
+
+// ÿȿͻľֵ*relative_variance ΪֵԷ
+double mean_priority_served(int days, int count, int seed, double* relative_variance) {
+    double sum = 0, sum2 = 0;
+    for (int j = 0; j < days; j++) {
+        cached_replication(count, seed + j);
+        sum += stats.served_count[1];
+        sum2 += (double)stats.served_count[1] * stats.served_count[1];
+    }
+    double mean = sum / days;
+    double variance = days > 1 ? (sum2 - days * mean * mean) / (days - 1) : 0;
+    *relative_variance = mean > 0 ? variance / days / (mean * mean) : 0;
+    return mean;
+}
+
+// ֱģһ죨棩¼ڻֱģĹ
+long crude_day_steps(int mode, double target, int count, int seed) {
+    long begin = rare_event_steps;
+    free_all_queues();
+    next_customer_id = 1;
+    generate_customers_random(count, seed);
+    current_time = 0;
+    start_simulation();
+    if (mode == RARE_QUEUE_LENGTH) {
+        run_until_level(target, mode);
+    } else {
+        while (step_simulation()) rare_event_steps++;
+    }
+    free_all_queues();
+    return rare_event_steps - begin;
+}
+
+// ֱģգ runs 죬ɽ档ŶģʽͳƵŶﵽĿ
+// ȵȴģʽͳƵȴֵȿͻռѷȿͻıֱֵͼ
+// ߽ʱͻʹû档*relative_error ΪûʱΪ0
+double crude_estimate(int mode, double target, int runs, int count, int seed, double* relative_error) {
+    double x = 0, n = 0, xx = 0, xn = 0, nn = 0;
+    double bins = target / WAIT_HIST_WIDTH;
+    bool from_histogram = bins == floor(bins) && bins >= 0 && bins < WAIT_HIST_BINS;
+    
+    for (int j = 0; j < runs; j++) {
+        double hit, total = 1;
+        if (mode == RARE_QUEUE_LENGTH) {
+            cached_replication(count, seed + j);
+            hit = stats.max_waiting >= target;
+        } else {
+            hit = 0;
+            if (from_histogram) {
+                cached_replication(count, seed + j);
+                for (int k = (int)bins; k < WAIT_HIST_BINS; k++) hit += stats.wait_histogram[1][k];
+            } else {
+                run_replication(count, seed + j);
+                for (int i = 0; i < params.customer_count; i++) hit += priority_wait_exceeded(i, target);
+            }
+            total = stats.served_count[1];
+        }
+        x += hit;
+        n += total;
+        xx += hit * hit;
+        xn += hit * total;
+        nn += total * total;
+    }
+    
+    // ֵƵdelta
+    double p = n > 0 ? x / n : 0;
+    double spread = xx - 2 * p * xn + p * p * nn;
+    *relative_error = x > 0 && runs > 1 ? sqrt(spread / (runs - 1) * runs) / x : 0;
+    return p;
+}
+
+void rare_event_mode() {
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    bool original_print_events = print_events;
+    int mode, effort, level_count, crude_runs;
+    double target, level_step;
+    const int count = 1000, seed = 4242;
+    double levels[MAX_SPLIT_LEVELS];
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("ϡ¼ʹƣˮƽѣ\n");
+    print_separator(50, '*');
+    
+    params.initial_windows = 1;
+    params.max_windows = 1;
+    params.min_windows = 1;
+    params.priority_ratio = 0.7;
+    params.simulation_time = 480;
+    params.arrival_rate = 1.4;
+    params.balk_threshold = 0;
+    params.mean_patience = 0;
+    params.business_types = 1;
+    log_events = false;
+    print_events = false;
+    
+    printf(",  %.2f,  %.2f, ʱ %d \n",
+           params.arrival_rate, params.service_rate, params.simulation_time);
+    printf("Ŀ (1-ȿͻȴֵĸ(ͻ), 2-Ŷﵽֵĸ): ");
+    scanf("%d", &mode);
+    mode = mode == 2 ? RARE_QUEUE_LENGTH : RARE_PRIORITY_WAIT;
+    printf(mode == RARE_PRIORITY_WAIT ? "ȴʱֵ (, 30): " : "Ŷֵ (40): ");
+    scanf("%lf", &target);
+    printf("ÿ켣 (1000): ");
+    scanf("%d", &effort);
+    printf(mode == RARE_PRIORITY_WAIT ? "ˮƽ (ȿͻѵȴ, 5): " : "ˮƽ (Ŷ, 2): ");
+    scanf("%lf", &level_step);
+    printf("мˮƽ (1-%d, 3): ", MAX_SPLIT_LEVELS);
+    scanf("%d", &level_count);
+    printf("ֱģ (0-): ");
+    scanf("%d", &crude_runs);
+    
+    if (effort < 1) effort = 1;
+    if (mode == RARE_QUEUE_LENGTH) level_step = level_step < 1 ? 1 : floor(level_step);
+    if (level_count < 1) level_count = 1;
+    if (level_count > MAX_SPLIT_LEVELS) level_count = MAX_SPLIT_LEVELS;
+    for (int k = 0; k < level_count; k++) {
+        levels[k] = level_step * (k + 1);
+    }
+    if (level_step <= 0 || levels[level_count - 1] >= target) {
+        printf("ˮƽΪҶĿֵ %gǰˮƽ %gСˮƽˮƽ\n",
+               target, levels[level_count - 1]);
+        params = original_params;
+        log_events = original_log_events;
+        print_events = original_print_events;
+        return;
+    }
+    
+    double relative_error;
+    rare_event_steps = 0;
+    clock_t begin = clock();
+    double p = splitting_estimate(mode, target, levels, level_count, effort, count, seed, &relative_error);
+    long split_steps = rare_event_steps;
+    double served = 0;
+    if (mode == RARE_PRIORITY_WAIT && p > 0) {
+        // ÿ쳬ÿȿͻõͻĸ
+        double served_variance;
+        served = mean_priority_served(RARE_NORMALIZE_DAYS, count, seed + 2000003, &served_variance);
+        p /= served;
+        relative_error = sqrt(relative_error * relative_error + served_variance);
+    }
+    double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+    
+    printf("\nƶ: %s\n", mode == RARE_PRIORITY_WAIT ?
+           "P(ȿͻȴֵ)" : "P(Ŷﵽֵ)");
+    if (p <= 0) {
+        printf("ûй켣Ŀ꣬޷ƣÿ켣ˮƽ, ¼ %ld , ʱ %.2f \n",
+               split_steps, seconds);
+    } else {
+        printf("ѹ: P = %.4e,  %.2f%%, ¼ %ld , ʱ %.2f \n",
+               p, relative_error * 100, split_steps, seconds);
+        if (mode == RARE_PRIORITY_WAIT) {
+            printf("ÿԼ %.1f ȿͻ %d йƣ\n", served, RARE_NORMALIZE_DAYS);
+        }
+    }
+    
+    if (p > 0 && relative_error > 0) {
+        // ֱģҪﵽͬ¼ȵȴ޿ͻƶ㣩
+        long day_steps = crude_day_steps(mode, target, count, seed);
+        double crude_needed = mode == RARE_PRIORITY_WAIT ?
+            1 / (p * served * relative_error * relative_error) :
+            (1 - p) / (p * relative_error * relative_error);
+        double ratio = crude_needed * day_steps / split_steps;
+        printf("ֱģԼ %.3e  (Լ %.3e ¼) ܴﵽͬȣ",
+               crude_needed, crude_needed * day_steps);
+        if (ratio >= 1) {
+            printf("ԼΪѷ %.2f \n", ratio);
+        } else {
+            printf("Ϊѷ %.2f ·ѷû\n", ratio);
+        }
+    }
+    
+    if (crude_runs > 0) {
+        double crude_error;
+        double crude = crude_estimate(mode, target, crude_runs, count, seed + 1000003, &crude_error);
+        if (crude > 0) {
+            printf("ֱģ %d : P = %.4e,  %.2f%%\n", crude_runs, crude, crude_error * 100);
+        } else {
+            printf("ֱģ %d : ûеĿ꣬޷\n", crude_runs);
+        }
+    }
+    
+    params = original_params;
+    log_events = original_log_events;
+    print_events = original_print_events;
+}
+
+// ==================== ֲʾ ====================
+const char* distribution_name(int kind) {
+    switch (kind) {
+        case DIST_HISTOGRAM: return "ֱͼ";
+        case DIST_SAMPLES: return "ʵ";
+        case DIST_LOGNORMAL: return "̬";
+        case DIST_GAMMA: return "٤";
+        case DIST_PHASE_TYPE: return "λ";
+        default: return "ָ";
+    }
+}
+
+// ͬһϱȽָģ뾭ֲģֻͣһΣظй
+void distribution_mode() {
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    bool original_print_events = print_events;
+    const int count = 800, seed = 3100, samples = 1000000;
+    char path[256];
+    int replications;
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("ֲ\n");
+    print_separator(50, '*');
+    
+    printf("ֲļ· (ֱӻسʹʾ): ");
+    if (fgets(path, sizeof(path), stdin) == NULL) path[0] = '\0';
+    path[strcspn(path, "\r\n")] = '\0';
+    printf("ظд (20): ");
+    scanf("%d", &replications);
+    if (replications < 1) replications = 1;
+    
+    params.initial_windows = 3;
+    params.max_windows = 5;
+    params.min_windows = 2;
+    params.business_types = 3;
+    params.simulation_time = 480;
+    log_events = false;
+    print_events = false;
+    
+    clock_t begin = clock();
+    WorkloadModel* model = path[0] != '\0' ? load_workload_model(path) : builtin_workload_model();
+    double load_ms = (double)(clock() - begin) * 1000 / CLOCKS_PER_SEC;
+    if (model == NULL) {
+        printf("޷ļ %s\n", path);
+        params = original_params;
+        log_events = original_log_events;
+        print_events = original_print_events;
+        return;
+    }
+    
+    printf("\nģԴ: %s, ʱ %.3f  (н %.3f )\n",
+           model->source, load_ms, model->setup_ms);
+    printf("%-4s %-10s %-8s %-14s %-12s\n", "", "", "ģ", "()", "(/)");
+    for (int k = 0; k < model->owned_count; k++) {
+        Distribution* d = model->owned[k];
+        double sum = 0;
+        clock_t sample_begin = clock();
+        for (int j = 0; j < samples; j++) {
+            sum += sample_distribution(d);
+        }
+        double seconds = (double)(clock() - sample_begin) / CLOCKS_PER_SEC;
+        printf("%-4d %-10s %-8d %-14.4f %-12.1f (ֵ %.3f)\n", k + 1, distribution_name(d->kind),
+               d->n, d->setup_ms, seconds > 0 ? samples / seconds / 1e6 : 0.0, sum / samples);
+    }
+    
+    // ֹظͬ
+    double wait[2][2] = {{0}}, run_seconds[2];
+    int served[2] = {0};
+    for (int m = 0; m < 2; m++) {
+        workload_model = m == 1 ? model : NULL;
+        clock_t run_begin = clock();
+        for (int r = 0; r < replications; r++) {
+            run_replication(count, seed + r);
+            wait[m][0] += stats.avg_wait_time[0] / replications;
+            wait[m][1] += stats.avg_wait_time[1] / replications;
+            served[m] += stats.served_count[0] + stats.served_count[1];
+        }
+        run_seconds[m] = (double)(clock() - run_begin) / CLOCKS_PER_SEC;
+    }
+    workload_model = NULL;
+    
+    printf("\n%d ظ (ÿ %d ͻ):\n", replications, count);
+    printf("%-12s %-12s %-12s %-12s %-10s\n", "", "ͨȴ", "ȵȴ", "ƽ", "ʱ()");
+    for (int m = 0; m < 2; m++) {
+        printf("%-12s %-12.2f %-12.2f %-12.1f %-10.3f\n", m == 0 ? "ֲָ" : "ֲ",
+               wait[m][0], wait[m][1], (double)served[m] / replications, run_seconds[m]);
+    }
+    printf("̯ÿ: %.4f  (ѻ棬ٴμͬһļٽ)\n",
+           model->setup_ms / replications);
+    
+    params = original_params;
+    log_events = original_log_events;
+    print_events = original_print_events;
+}
+
+// ==================== վ纯 ====================
+// վͼģͣÿվԼĴڡȹ򣬷ɺ·ɾתһվ뿪硣
+// ͻͬһʱһ¼ɣ¼Ѱͻλ
+// ·վ㶼ñ¼Ŀվ޹أֻɶϵ
+#define NET_FIFO     0      // ȵȷ񣨲
+#define NET_PRIORITY 1      // ȿͻ
+#define NET_RATIO    2      // ඼ʱȱѡͬ棩
+#define NET_EXIT    -1      // ·Ŀ꣺뿪
+#define NET_SOURCE_SLOT 0   // λ0Ϊⲿͻλ j Ӧ¼λ j+1
+#define NET_PRIORITY_SHARE 0.3  // ȿͻ
+#define NET_MAX_ROUTES 8
+
+typedef struct {
+    char name[32];
+    int servers;            // 
+    int busy;               // æµ
+    int discipline;         // ȹ
+    double priority_ratio;  // NET_RATIO ʱȱ
+    Distribution* service;  // ʱֲվУ
+    int head[2], tail[2];   // Уͻλ-1Ϊգ[0ͨ,1]
+    int queue_length;       // Ŷ
+    int route_count;        // ·Ŀ
+    int* targets;           // ·Ŀվ㣨NET_EXIT ʾ뿪
+    double* route_prob;     // ·ɱ
+    int* route_alias;
+    int visits;             // ﱾվ
+    int completions;        // ɷ
+    double total_wait;      // ܵȴʱ
+    double total_sojourn;   // ܶʱ䣨ȴ+
+    double busy_time;       // æµʱ
+    int max_queue;          // Ŷ
+} NetStation;
+
+typedef struct {
+    int type;               // 0-ͨ, 1-
+    int station;            // ǰվ
+    double enter_time;      // ʱ
+    double station_arrival; // ﵱǰվʱ
+    double start_time;      // վʼʱ
+    int hops;               // ɵķ
+    int next;               // еḷ́ʱΪḷ́
+} NetJob;
+
+typedef struct {
+    NetStation* stations;
+    int station_count;
+    double external_rate;   // ⲿʣͻ/ӣ
+    ArrivalProcess* arrivals; // ⲿ̣ΪNULLʱ external_rate ɵ
+    int entry_count;        // ɽվ
+    int* entry_station;
+    double* entry_prob;     // վ
+    int* entry_alias;
+    NetJob* jobs;           // ͻλ
+    int job_capacity;
+    int free_job;           // вλͷ
+    EventHeap heap;
+    double now;
+    int entered;            // 
+    int rejected;           // ﵽޱܾ
+    int departed[2];        // 뿪
+    double total_response[2]; // ˵˶ʱ֮
+    double max_response[2];   // ˵˶ʱ
+    long total_hops;        // 뿪ۼƷ
+    long events;            // Ѵ¼
+} Network;
+
+Network* create_network(int station_count, int job_capacity) {
+    Network* net = (Network*)calloc(1, sizeof(Network));
+    net->station_count = station_count;
+    net->stations = (NetStation*)calloc(station_count, sizeof(NetStation));
+    net->job_capacity = job_capacity;
+    net->jobs = (NetJob*)malloc(sizeof(NetJob) * job_capacity);
+    return net;
+}
+
+void free_network(Network* net) {
+    if (net == NULL) return;
+    for (int s = 0; s < net->station_count; s++) {
+        free_distribution(net->stations[s].service);
+        free(net->stations[s].targets);
+        free(net->stations[s].route_prob);
+        free(net->stations[s].route_alias);
+    }
+    free(net->stations);
+    free(net->entry_station);
+    free(net->entry_prob);
+    free(net->entry_alias);
+    free(net->jobs);
+    free_event_heap(&net->heap);
+    free(net);
+}
+
+void set_station(Network* net, int s, const char* name, int servers, int discipline,
+                 double priority_ratio, Distribution* service) {
+    NetStation* st = &net->stations[s];
+    snprintf(st->name, sizeof(st->name), "%s", name);
+    st->servers = servers;
+    st->discipline = discipline;
+    st->priority_ratio = priority_ratio;
+    free_distribution(st->service);
+    st->service = service;
+}
+
+// ·ɾһУϡ洢 weights[k] ıת targets[k]
+void set_routing(Network* net, int s, const int* targets, const double* weights, int count) {
+    NetStation* st = &net->stations[s];
+    free(st->targets);
+    free(st->route_prob);
+    free(st->route_alias);
+    st->route_count = count;
+    st->targets = (int*)malloc(sizeof(int) * count);
+    st->route_prob = (double*)malloc(sizeof(double) * count);
+    st->route_alias = (int*)malloc(sizeof(int) * count);
+    memcpy(st->targets, targets, sizeof(int) * count);
+    build_alias_table(weights, count, st->route_prob, st->route_alias);
+}
+
+void set_entry(Network* net, double rate, const int* stations, const double* weights, int count) {
+    free(net->entry_station);
+    free(net->entry_prob);
+    free(net->entry_alias);
+    net->external_rate = rate;
+    net->entry_count = count;
+    net->entry_station = (int*)malloc(sizeof(int) * count);
+    net->entry_prob = (double*)malloc(sizeof(double) * count);
+    net->entry_alias = (int*)malloc(sizeof(int) * count);
+    memcpy(net->entry_station, stations, sizeof(int) * count);
+    build_alias_table(weights, count, net->entry_prob, net->entry_alias);
+}
+
+// ͻͳƣṹ
+void reset_network(Network* net) {
+    for (int s = 0; s < net->station_count; s++) {
+        NetStation* st = &net->stations[s];
+        st->busy = 0;
+        st->head[0] = st->head[1] = st->tail[0] = st->tail[1] = -1;
+        st->queue_length = 0;
+        st->visits = st->completions = st->max_queue = 0;
+        st->total_wait = st->total_sojourn = st->busy_time = 0;
+        st->service->batch_pos = st->service->batch_len = 0;
+    }
+    for (int j = 0; j < net->job_capacity; j++) {
+        net->jobs[j].next = j + 1 < net->job_capacity ? j + 1 : -1;
+    }
+    net->free_job = 0;
+    init_event_heap(&net->heap, net->job_capacity + 1);
+    net->now = 0;
+    net->entered = net->rejected = 0;
+    net->departed[0] = net->departed[1] = 0;
+    net->total_response[0] = net->total_response[1] = 0;
+    net->max_response[0] = net->max_response[1] = 0;
+    net->total_hops = 0;
+    net->events = 0;
+}
+
+void net_start_service(Network* net, int j, int s) {
+    NetStation* st = &net->stations[s];
+    NetJob* job = &net->jobs[j];
+    st->busy++;
+    job->start_time = net->now;
+    st->total_wait += net->now - job->station_arrival;
+    schedule_event(&net->heap, j + 1, net->now + sample_distribution(st->service));
+}
+
+// վȹȡһλŶӿͻŶӷ-1
+int net_dequeue(Network* net, int s) {
+    NetStation* st = &net->stations[s];
+    int cls;
+    
+    if (st->head[0] == -1 && st->head[1] == -1) return -1;
+    if (st->head[0] == -1) {
+        cls = 1;
+    } else if (st->head[1] == -1) {
+        cls = 0;
+    } else if (st->discipline == NET_PRIORITY) {
+        cls = 1;
+    } else if (st->discipline == NET_RATIO) {
+        cls = uniform01() < st->priority_ratio ? 1 : 0;
+    } else {
+        // ȵȷȵվһ
+        cls = net->jobs[st->head[1]].station_arrival < net->jobs[st->head[0]].station_arrival ? 1 : 0;
+    }
+    
+    int j = st->head[cls];
+    st->head[cls] = net->jobs[j].next;
+    if (st->head[cls] == -1) st->tail[cls] = -1;
+    st->queue_length--;
+    return j;
+}
+
+void net_arrive(Network* net, int j, int s) {
+    NetStation* st = &net->stations[s];
+    NetJob* job = &net->jobs[j];
+    job->station = s;
+    job->station_arrival = net->now;
+    st->visits++;
+    
+    if (st->busy < st->servers) {
+        net_start_service(net, j, s);
+        return;
+    }
+    
+    int cls = job->type;
+    job->next = -1;
+    if (st->tail[cls] == -1) st->head[cls] = j;
+    else net->jobs[st->tail[cls]].next = j;
+    st->tail[cls] = j;
+    st->queue_length++;
+    if (st->queue_length > st->max_queue) st->max_queue = st->queue_length;
+}
+
+void net_external_arrival(Network* net) {
+    double frac;
+    double next = net->arrivals != NULL ? next_arrival_time(net->arrivals)
+                                        : net->now + exponential_variate(net->external_rate);
+    schedule_event(&net->heap, NET_SOURCE_SLOT, next);
+    
+    int type = uniform01() < NET_PRIORITY_SHARE ? 1 : 0;
+    int s = net->entry_station[alias_pick(net->entry_prob, net->entry_alias, net->entry_count, &frac)];
+    if (net->free_job == -1) {
+        net->rejected++;
+        return;
+    }
+    
+    int j = net->free_job;
+    net->free_job = net->jobs[j].next;
+    net->jobs[j].type = type;
+    net->jobs[j].enter_time = net->now;
+    net->jobs[j].hops = 0;
+    net->entered++;
+    net_arrive(net, j, s);
+}
+
+void net_finish_service(Network* net, int j) {
+    NetJob* job = &net->jobs[j];
+    int s = job->station;
+    NetStation* st = &net->stations[s];
+    double frac;
+    
+    st->busy--;
+    st->completions++;
+    st->busy_time += net->now - job->start_time;
+    st->total_sojourn += net->now - job->station_arrival;
+    job->hops++;
+    
+    int next = net_dequeue(net, s);
+    if (next != -1) {
+        net_start_service(net, next, s);
+    }
+    
+    int target = NET_EXIT;
+    if (st->route_count > 0) {
+        target = st->targets[alias_pick(st->route_prob, st->route_alias, st->route_count, &frac)];
+    }
+    if (target != NET_EXIT) {
+        net_arrive(net, j, target);
+        return;
+    }
+    
+    double response = net->now - job->enter_time;
+    net->departed[job->type]++;
+    net->total_response[job->type] += response;
+    if (response > net->max_response[job->type]) net->max_response[job->type] = response;
+    net->total_hops += job->hops;
+    job->next = net->free_job;
+    net->free_job = j;
+}
+
+// ӿ翪ʼ浽 end_time
+void run_network(Network* net, double end_time, int seed) {
+    srand(seed);
+    reset_network(net);
+    if (net->arrivals != NULL) {
+        reset_arrival_process(net->arrivals);
+        schedule_event(&net->heap, NET_SOURCE_SLOT, next_arrival_time(net->arrivals));
+    } else {
+        schedule_event(&net->heap, NET_SOURCE_SLOT, exponential_variate(net->external_rate));
+    }
+    
+    while (true) {
+        int slot = peek_next_event(&net->heap);
+        if (slot == -1 || net->heap.time[slot] > end_time) break;
+        net->now = net->heap.time[slot];
+        pop_next_event(&net->heap);
+        net->events++;
+        
+        if (slot == NET_SOURCE_SLOT) {
+            net_external_arrival(net);
+        } else {
+            net_finish_service(net, slot - 1);
+        }
+    }
+    net->now = end_time;
+}
+
+// Ա -> ͻ -> ֽ̨ϷعԱķ
+Network* create_teller_network() {
+    Network* net = create_network(3, 5000);
+    int entry[] = {0};
+    double entry_weight[] = {1.0};
+    int teller_targets[] = {1, 2, NET_EXIT};
+    double teller_weights[] = {0.3, 0.4, 0.3};
+    int manager_targets[] = {2, 0, NET_EXIT};
+    double manager_weights[] = {0.5, 0.1, 0.4};
+    int cashier_targets[] = {NET_EXIT, 0};
+    double cashier_weights[] = {0.95, 0.05};
+    
+    set_station(net, 0, "Ա", 4, NET_RATIO, 0.7, create_exponential(1 / 3.0));
+    set_station(net, 1, "ͻ", 3, NET_PRIORITY, 0, create_lognormal(1.61, 0.6));
+    set_station(net, 2, "ֽ̨", 2, NET_FIFO, 0, create_gamma(2.0, 1.0));
+    set_routing(net, 0, teller_targets, teller_weights, 3);
+    set_routing(net, 1, manager_targets, manager_weights, 3);
+    set_routing(net, 2, cashier_targets, cashier_weights, 2);
+    set_entry(net, 1.0, entry, entry_weight, 1);
+    return net;
+}
+
+// 磺վ s ͬת s+d1s+d2s+d3ѭ뿪硣
+// վͬʾΪ external_rate / վ / exit_prob load ÷ʡ
+Network* create_grid_network(int station_count, double load) {
+    const double exit_prob = 0.2, per_station_rate = 0.4;
+    Network* net = create_network(station_count, station_count * 40 + 1000);
+    int offsets[3] = {1, 1 + station_count / 7, 1 + station_count / 3};
+    double station_rate = per_station_rate / exit_prob;
+    int* entry = (int*)malloc(sizeof(int) * station_count);
+    double* entry_weight = (double*)malloc(sizeof(double) * station_count);
+    char name[32];
+    
+    for (int s = 0; s < station_count; s++) {
+        int servers = 1 + s % 4;
+        int targets[NET_MAX_ROUTES];
+        double weights[NET_MAX_ROUTES];
+        for (int k = 0; k < 3; k++) {
+            targets[k] = (s + offsets[k]) % station_count;
+            weights[k] = (1 - exit_prob) / 3;
+        }
+        targets[3] = NET_EXIT;
+        weights[3] = exit_prob;
+        
+        snprintf(name, sizeof(name), "վ%d", s + 1);
+        set_station(net, s, name, servers, s % 3, 0.7, create_exponential(station_rate / (load * servers)));
+        set_routing(net, s, targets, weights, 4);
+        entry[s] = s;
+        entry_weight[s] = 1.0;
+    }
+    set_entry(net, per_station_rate * station_count, entry, entry_weight, station_count);
+    
+    free(entry);
+    free(entry_weight);
+    return net;
+}
+
+void print_network_statistics(const Network* net, int max_rows) {
+    const char* discipline_names[] = {"ȵȷ", "", ""};
+    int departed = net->departed[0] + net->departed[1];
+    
+    printf("\n%-10s %-6s %-10s %-8s %-10s %-10s %-8s %-8s\n",
+           "վ", "", "", "", "ƽȴ", "ƽ", "", "");
+    for (int s = 0; s < net->station_count && s < max_rows; s++) {
+        const NetStation* st = &net->stations[s];
+        printf("%-10s %-6d %-10s %-8d %-10.2f %-10.2f %6.1f%%  %-8d\n",
+               st->name, st->servers, discipline_names[st->discipline], st->visits,
+               st->completions > 0 ? st->total_wait / st->completions : 0.0,
+               st->completions > 0 ? st->total_sojourn / st->completions : 0.0,
+               st->busy_time / (st->servers * net->now) * 100, st->max_queue);
+    }
+    if (net->station_count > max_rows) {
+        printf("...  %d վ㣬ʾǰ %d \n", net->station_count, max_rows);
+    }
+    
+    printf("\n %d , 뿪 %d , Աܾ %d , ƽ %.2f η\n",
+           net->entered, departed, net->rejected, departed > 0 ? (double)net->total_hops / departed : 0.0);
+    for (int cls = 1; cls >= 0; cls--) {
+        if (net->departed[cls] > 0) {
+            printf("%sͻ˵˶: ƽ %.2f ,  %.2f  (%d )\n", cls == 1 ? "" : "ͨ",
+                   net->total_response[cls] / net->departed[cls], net->max_response[cls], net->departed[cls]);
+        }
+    }
+}
+
+void network_mode() {
+    int choice, station_count;
+    const int seed = 3200;
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("վŶ\n");
+    print_separator(50, '*');
+    printf("1. Ա -> ͻ -> ֽ̨\n");
+    printf("2. \n");
+    printf("3. ģԣÿ¼վĹϵ\n");
+    printf("ѡ (1-3): ");
+    scanf("%d", &choice);
+    
+    if (choice == 1) {
+        Network* net = create_teller_network();
+        run_network(net, params.simulation_time, seed);
+        printf("\n %d , ⲿ %.2f /\n", params.simulation_time, net->external_rate);
+        print_network_statistics(net, net->station_count);
+        free_network(net);
+    } else if (choice == 2) {
+        printf("վ (500): ");
+        scanf("%d", &station_count);
+        if (station_count < 4) station_count = 4;
+        Network* net = create_grid_network(station_count, 0.75);
+        clock_t begin = clock();
+        run_network(net, params.simulation_time, seed);
+        double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        print_network_statistics(net, 10);
+        printf("¼ %ld , ʱ %.2f \n", net->events, seconds);
+        free_network(net);
+    } else {
+        // ¼ͬȽÿ¼ʱ
+        const int sizes[] = {4, 16, 64, 256, 1024, 4096};
+        printf("\n%-8s %-12s %-12s %-14s %-12s\n", "վ", "ʱ", "¼", "/¼", "ƽ");
+        for (int k = 0; k < 6; k++) {
+            Network* net = create_grid_network(sizes[k], 0.75);
+            double end_time = 2000000.0 / (6 * net->external_rate); // ÿƽ5ηԼ6¼
+            clock_t begin = clock();
+            run_network(net, end_time, seed);
+            double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+            int departed = net->departed[0] + net->departed[1];
+            printf("%-8d %-12.0f %-12ld %-14.1f %-12.2f\n", sizes[k], end_time, net->events,
+                   seconds * 1e9 / net->events,
+                   departed > 0 ? (net->total_response[0] + net->total_response[1]) / departed : 0.0);
+            free_network(net);
+        }
+        printf("ÿ¼ʱĻࣨ¼ѵĶ뻺δУ治վɨ\n");
+    }
+}
+
+// ==================== ѹ׼Ժ ====================
+// ÿԤ赽ﳡֱ棨̬ڵȣ棬¼ٶŶӱ
+#define STRESS_SITE_RATE 1.5    // ŵƽʣ/ӣÿԼ720ˣڿͻ
+
+void stress_benchmark_mode() {
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    bool original_print_events = print_events;
+    const int count = MAX_CUSTOMERS, seed = 3300, replications = 50, network_size = 256;
+    ArrivalProcess process;
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("ѹ׼\n");
+    print_separator(50, '*');
+    
+    params.initial_windows = 2;
+    params.max_windows = 6;
+    params.min_windows = 2;
+    params.service_rate = 0.4;
+    log_events = false;
+    print_events = false;
+    
+    // ʱʳнضϣʵʾֵͳ
+    printf("\n (%d-%d ,  %.2f/, %d ظ, ƽ %.2f/, ÿ %d ):\n",
+           params.min_windows, params.max_windows, params.service_rate, replications,
+           STRESS_SITE_RATE, MAX_CUSTOMERS);
+    printf("%-12s %-10s %-10s %-8s %-10s %-10s %-10s %-10s %-12s\n",
+           "", "ԭʼ", "", "ض", "ʵʷ", "ͨȴ", "ȵȴ", "ȴ", "/¼");
+    int truncated_total = 0;
+    for (int k = 0; k < ARRIVAL_PRESETS; k++) {
+        // ͬŵͳһƽʣʱ״
+        preset_arrival_process(&process, k);
+        double preset_rate = arrival_mean_rate(&process);
+        process.scale *= STRESS_SITE_RATE / preset_rate;
+        arrival_process = &process;
+        double wait[2] = {0, 0}, max_wait = 0, service_sum = 0, seconds = 0;
+        long timed_events = 0, arrived = 0, generated = 0;
+        int truncated = 0;
+        for (int r = 0; r < replications; r++) {
+            // ֻͳʵУδл棩ظĺʱ
+            clock_t begin = clock();
+            bool hit = cached_replication(count, seed + r);
+            if (!hit) {
+                seconds += (double)(clock() - begin) / CLOCKS_PER_SEC;
+                timed_events += event_count;
+            }
+            truncated += arrivals_truncated;
+            for (int i = 0; i < params.customer_count; i++) {
+                service_sum += customers[i].service_time;
+            }
+            generated += params.customer_count;
+            wait[0] += stats.avg_wait_time[0] / replications;
+            wait[1] += stats.avg_wait_time[1] / replications;
+            if (stats.max_wait_time[0] > max_wait) max_wait = stats.max_wait_time[0];
+            if (stats.max_wait_time[1] > max_wait) max_wait = stats.max_wait_time[1];
+            arrived += stats.arrived_count[0] + stats.arrived_count[1];
+        }
+        printf("%-12s %-10.2f %-10ld %-8d %-10.2f %-10.2f %-10.2f %-10.2f ", process.name,
+               preset_rate, arrived / replications, truncated,
+               generated > 0 ? service_sum / generated : 0.0, wait[0], wait[1], max_wait);
+        if (timed_events > 0) {
+            printf("%-12.1f\n", seconds * 1e9 / timed_events);
+        } else {
+            printf("%-12s\n", "()");
+        }
+        truncated_total += truncated;
+    }
+    arrival_process = NULL;
+    if (truncated_total > 0) {
+        printf("ע\"ض\"Ϊ쵽ﵽ %d ޵ظĵﱻȴʱƫ\n"
+               " -DMAX_CUSTOMERS=4000 ²ԣ\n",
+               MAX_CUSTOMERS);
+    }
+    
+    // 棺ʰŵĶأ߷ͻʱֲ
+    Network* net = create_grid_network(network_size, 0.75);
+    printf("\n%d վ ( 75%%, ÿԼ %d ¼):\n", network_size, 200);
+    printf("%-12s %-10s %-12s %-10s %-12s %-12s\n",
+           "", "", "/", "ܾ", "ƽ", "/¼");
+    for (int k = 0; k < ARRIVAL_PRESETS; k++) {
+        preset_arrival_process(&process, k);
+        process.scale *= net->external_rate / arrival_mean_rate(&process);
+        net->arrivals = &process;
+        double end_time = 2000000.0 / (6 * net->external_rate);
+        end_time = ceil(end_time / 480) * 480; // ȡ죬ʱظ
+        
+        clock_t begin = clock();
+        run_network(net, end_time, seed);
+        double seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        int departed = net->departed[0] + net->departed[1];
+        printf("%-12s %-10.0f %-12.3f %-10d %-12.2f %-12.1f\n", process.name, end_time / 480,
+               (net->entered + net->rejected) / (net->external_rate * end_time), net->rejected,
+               departed > 0 ? (net->total_response[0] + net->total_response[1]) / departed : 0.0,
+               seconds * 1e9 / net->events);
+        if (process.kind == ARRIVAL_SCHEDULE) {
+            printf("%-12s ϡ軯 %.1f%%\n", "", 100.0 * process.accepted / process.candidates);
+        }
+    }
+    net->arrivals = NULL;
+    free_network(net);
+    
+    params = original_params;
+    log_events = original_log_events;
+    print_events = original_print_events;
+}
+
+// ==================== 溯 ====================
+// ͬһ LOCKSTEP_LANES ظа"ͨ"Ŵţͨ±ڲ㣩
+// ÿһͨͬʱһ¼ۼƿʱ䣬ֱٰɡ
+// Сģһҵ񡢲ʧڵ뵥ͬ
+// ȱɿͻ rand() ԭ˳Ԥȡÿͨ
+// ͬһ run_simulation() Ľȫһ¡
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 8        //  -DLOCKSTEP_LANES=16 
+#endif
+#if LOCKSTEP_LANES > 32
+#error "LOCKSTEP_LANES ܳ 32ͨΪ32λ"
+#endif
+#define LANE_MASK_ALL ((1u << LOCKSTEP_LANES) - 1)
+
+typedef struct {
+    double arrival[MAX_CUSTOMERS][LOCKSTEP_LANES];  // ʱ
+    double service[MAX_CUSTOMERS][LOCKSTEP_LANES];  // ʱ
+    int type[MAX_CUSTOMERS][LOCKSTEP_LANES];        // ͻ
+    int next_same[MAX_CUSTOMERS][LOCKSTEP_LANES];   // ͬһλͻа˳
+    unsigned char draw[MAX_CUSTOMERS][LOCKSTEP_LANES]; // Ԥȡ rand() % 100
+    double finish[MAX_WINDOWS][LOCKSTEP_LANES];     // ʱ̣Ϊ INFINITY
+    double busy_start[MAX_WINDOWS][LOCKSTEP_LANES];
+    double busy_time[MAX_WINDOWS][LOCKSTEP_LANES];
+    double idle_time[MAX_WINDOWS][LOCKSTEP_LANES];
+    double open[MAX_WINDOWS][LOCKSTEP_LANES];       // 1.0  / 0.0 رգʱˣ
+    int serving[MAX_WINDOWS][LOCKSTEP_LANES];
+    double clock[LOCKSTEP_LANES];
+    int next_arrival[LOCKSTEP_LANES];               // һλĿͻ±
+    int head[2][LOCKSTEP_LANES];                    // δʼĿͻ
+    int waiting[2][LOCKSTEP_LANES];                 // Ŷ
+    int peak_waiting[LOCKSTEP_LANES];               // Ŷֵ
+    int draw_pos[LOCKSTEP_LANES];
+    int active_windows[LOCKSTEP_LANES];
+    double total_wait[2][LOCKSTEP_LANES];
+    double max_wait[2][LOCKSTEP_LANES];
+    int served[2][LOCKSTEP_LANES];
+    int histogram[2][WAIT_HIST_BINS][LOCKSTEP_LANES];
+    int customer_count;
+} LockstepBatch;
+
+LockstepBatch lockstep;
+
+// ֻʵ˵ҵȫܴڡʲɵҿͻܾ/뿪
+bool lockstep_supported() {
+    if (params.business_types != 1 || params.balk_threshold != 0 || params.mean_patience != 0 ||
+        gradient_estimation || workload_model != NULL || arrival_process != NULL) {
+        return false;
+    }
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        if (window_skills[i] != 0 && (window_skills[i] & 1) == 0) return false;
+    }
+    return true;
+}
+
+// ÿͨøԵɿͻ run_replication ͬԤȡõ
+void lockstep_load(const int* seeds) {
+    for (int l = 0; l < LOCKSTEP_LANES; l++) {
+        next_customer_id = 1;
+        generate_customers_random(params.customer_count, seeds[l]);
+        int last[2] = {-1, -1};
+        
+        lockstep.head[0][l] = lockstep.head[1][l] = params.customer_count;
+        for (int i = 0; i < params.customer_count; i++) {
+            int cls = customers[i].type;
+            lockstep.arrival[i][l] = customers[i].arrival_time;
+            lockstep.service[i][l] = customers[i].service_time;
+            lockstep.type[i][l] = cls;
+            lockstep.next_same[i][l] = params.customer_count;
+            if (last[cls] == -1) lockstep.head[cls][l] = i;
+            else lockstep.next_same[last[cls]][l] = i;
+            last[cls] = i;
+        }
+        for (int i = 0; i < params.customer_count; i++) {
+            lockstep.draw[i][l] = rand() % 100;
+        }
+    }
+    lockstep.customer_count = params.customer_count;
+    
+    for (int w = 0; w < MAX_WINDOWS; w++) {
+        for (int l = 0; l < LOCKSTEP_LANES; l++) {
+            lockstep.finish[w][l] = INFINITY;
+            lockstep.busy_start[w][l] = 0;
+            lockstep.busy_time[w][l] = 0;
+            lockstep.idle_time[w][l] = 0;
+            lockstep.open[w][l] = w < params.initial_windows ? 1.0 : 0.0;
+        }
+    }
+    for (int l = 0; l < LOCKSTEP_LANES; l++) {
+        lockstep.clock[l] = 0;
+        lockstep.next_arrival[l] = 0;
+        lockstep.waiting[0][l] = lockstep.waiting[1][l] = 0;
+        lockstep.peak_waiting[l] = 0;
+        lockstep.draw_pos[l] = 0;
+        lockstep.active_windows[l] = params.initial_windows;
+        for (int cls = 0; cls < 2; cls++) {
+            lockstep.total_wait[cls][l] = 0;
+            lockstep.max_wait[cls][l] = 0;
+            lockstep.served[cls][l] = 0;
+            for (int k = 0; k < WAIT_HIST_BINS; k++) lockstep.histogram[cls][k][l] = 0;
+        }
+    }
+}
+
+// ͬ get_next_customer()඼ʱȱǩȡ˵һࣻ˷-1
+int lockstep_next_customer(int l) {
+    int cls;
+    if (lockstep.waiting[1][l] > 0 && lockstep.waiting[0][l] > 0) {
+        cls = lockstep.draw[lockstep.draw_pos[l]++][l] < (int)(params.priority_ratio * 100) ? 1 : 0;
+    } else if (lockstep.waiting[1][l] > 0) {
+        cls = 1;
+    } else if (lockstep.waiting[0][l] > 0) {
+        cls = 0;
+    } else {
+        return -1;
+    }
     
-    double single_avg_wait = (stats.avg_wait_time[0] + stats.avg_wait_time[1]) / 2;
-    printf("ƽȴʱ: %.2f\n", single_avg_wait);
-    printf(": %.2fͻ/Сʱ\n", stats.throughput);
+    int i = lockstep.head[cls][l];
+    lockstep.head[cls][l] = lockstep.next_same[i][l];
+    lockstep.waiting[cls][l]--;
+    return i;
+}
+
+void lockstep_assign(int l, int w, int i) {
+    lockstep.serving[w][l] = i;
+    lockstep.busy_start[w][l] = lockstep.clock[l];
+    lockstep.finish[w][l] = lockstep.clock[l] + lockstep.service[i][l];
+}
+
+// ͬ adjust_windows()
+void lockstep_adjust_windows(int l) {
+    int total = lockstep.waiting[0][l] + lockstep.waiting[1][l];
     
-    // նڴ
-    free_queue_memory(&priority_queue);
-    free_queue_memory(&normal_queue);
+    if (total > params.open_threshold) {
+        for (int w = 0; w < params.max_windows; w++) {
+            if (lockstep.open[w][l] == 0) {
+                if (lockstep.active_windows[l] < params.max_windows) {
+                    lockstep.open[w][l] = 1.0;
+                    lockstep.active_windows[l]++;
+                }
+                break;
+            }
+        }
+    } else if (total < params.close_threshold) {
+        for (int w = 0; w < params.max_windows; w++) {
+            if (lockstep.open[w][l] != 0 && lockstep.finish[w][l] == INFINITY) {
+                if (lockstep.active_windows[l] > params.min_windows) {
+                    lockstep.open[w][l] = 0;
+                    lockstep.active_windows[l]--;
+                }
+                break;
+            }
+        }
+    }
+}
+
+void lockstep_arrival(int l) {
+    int i = lockstep.next_arrival[l]++;
+    lockstep.waiting[lockstep.type[i][l]][l]++;
     
-    // 2: еģ
-    printf("\n2. еģͲԣ\n");
-    for (int i = 0; i < 40; i++) printf("-");
-    printf("\n");
+    for (int w = 0; w < MAX_WINDOWS; w++) {
+        if (lockstep.open[w][l] != 0 && lockstep.finish[w][l] == INFINITY) {
+            int next = lockstep_next_customer(l);
+            if (next != -1) {
+                lockstep_assign(l, w, next);
+            }
+            break;
+        }
+    }
+    lockstep_adjust_windows(l);
     
-    params.initial_windows = 1;
-    params.max_windows = 1;
-    params.min_windows = 1;
-    params.priority_ratio = 0.7; // ȼ
-    params.open_threshold = 10;  // ֵЧĴڵ߼
-    params.close_threshold = 5;
+    // ֻеʹŶӱ䳤
+    int total = lockstep.waiting[0][l] + lockstep.waiting[1][l];
+    if (total > lockstep.peak_waiting[l]) lockstep.peak_waiting[l] = total;
+}
+
+void lockstep_finish(int l, int w) {
+    int i = lockstep.serving[w][l];
+    int cls = lockstep.type[i][l];
+    double wait = lockstep.busy_start[w][l] - lockstep.arrival[i][l];
     
-    generate_customers_random(30, 1001);
-    current_time = 0;
-    init_windows(); // ³ʼ
-    run_simulation();
-    calculate_statistics();
+    lockstep.busy_time[w][l] += lockstep.clock[l] - lockstep.busy_start[w][l];
+    lockstep.finish[w][l] = INFINITY;
+    lockstep.served[cls][l]++;
+    lockstep.total_wait[cls][l] += wait;
+    if (wait > lockstep.max_wait[cls][l]) lockstep.max_wait[cls][l] = wait;
+    lockstep.histogram[cls][wait_histogram_bin(wait)][l]++;
     
-    double multi_single_avg_wait = (stats.avg_wait_time[0] * stats.served_count[0] + 
-                                   stats.avg_wait_time[1] * stats.served_count[1]) / 
-                                   (stats.served_count[0] + stats.served_count[1]);
-    printf("ͨͻƽȴ: %.2f\n", stats.avg_wait_time[0]);
-    printf("ȿͻƽȴ: %.2f\n", stats.avg_wait_time[1]);
-    printf("Ȩƽȴ: %.2f\n", multi_single_avg_wait);
-    printf(": %.2fͻ/Сʱ\n", stats.throughput);
+    int next = lockstep_next_customer(l);
+    if (next != -1) {
+        lockstep_assign(l, w, next);
+    }
+    lockstep_adjust_windows(l);
+}
+
+// ͨһƽֱÿͨ
+void run_lockstep() {
+    const double end = params.simulation_time, cutoff = params.simulation_time + 1;
+    const int window_count = params.max_windows > params.initial_windows ? params.max_windows : params.initial_windows;
+    double next_time[LOCKSTEP_LANES], next_finish[LOCKSTEP_LANES], dt[LOCKSTEP_LANES];
+    int finish_window[LOCKSTEP_LANES];
+    unsigned running = LANE_MASK_ALL;
     
-    // նڴ
-    free_queue_memory(&priority_queue);
-    free_queue_memory(&normal_queue);
+    while (running) {
+        // ͨʱ봰ڣͬʱʱȡСĴڣ
+        for (int l = 0; l < LOCKSTEP_LANES; l++) {
+            next_finish[l] = INFINITY;
+            finish_window[l] = -1;
+        }
+        for (int w = 0; w < window_count; w++) {
+            for (int l = 0; l < LOCKSTEP_LANES; l++) {
+                bool earlier = lockstep.finish[w][l] < next_finish[l];
+                next_finish[l] = earlier ? lockstep.finish[w][l] : next_finish[l];
+                finish_window[l] = earlier ? w : finish_window[l];
+            }
+        }
+        
+        // ͬʱʱȴ¼ѵĲλһ£
+        unsigned arrivals = 0, stopped = 0;
+        for (int l = 0; l < LOCKSTEP_LANES; l++) {
+            double arrival = lockstep.next_arrival[l] < lockstep.customer_count ?
+                             lockstep.arrival[lockstep.next_arrival[l]][l] : INFINITY;
+            bool is_arrival = arrival <= next_finish[l];
+            next_time[l] = is_arrival ? arrival : next_finish[l];
+            bool stop = next_time[l] >= cutoff;
+            arrivals |= (unsigned)(is_arrival && !stop) << l;
+            stopped |= (unsigned)stop << l;
+            // ѽͨʱΪ0սͨ뵽ʱ
+            double target = stop ? end : next_time[l];
+            dt[l] = (running >> l & 1) ? target - lockstep.clock[l] : 0;
+        }
+        stopped &= running;
+        
+        for (int w = 0; w < window_count; w++) {
+            for (int l = 0; l < LOCKSTEP_LANES; l++) {
+                lockstep.idle_time[w][l] += lockstep.open[w][l] * (lockstep.finish[w][l] == INFINITY) * dt[l];
+            }
+        }
+        for (int l = 0; l < LOCKSTEP_LANES; l++) {
+            lockstep.clock[l] += dt[l];
+        }
+        
+        unsigned handle = running & ~stopped;
+        running = handle;
+        arrivals &= handle;
+        for (unsigned mask = arrivals; mask; mask &= mask - 1) {
+            lockstep_arrival(lowest_bit(mask));
+        }
+        for (unsigned mask = handle & ~arrivals; mask; mask &= mask - 1) {
+            int l = lowest_bit(mask);
+            lockstep_finish(l, finish_window[l]);
+        }
+        
+        // ¼ʱѵʱ̵ֹͨͣ
+        for (int l = 0; l < LOCKSTEP_LANES; l++) {
+            if (lockstep.clock[l] >= end) running &= ~(1u << l);
+        }
+    }
+}
+
+//  calculate_statistics() Ŀھ l ͨͳ
+void lockstep_statistics(int l, Statistics* out) {
+    memset(out, 0, sizeof(Statistics));
+    double now = lockstep.clock[l];
+    
+    for (int cls = 0; cls < 2; cls++) {
+        out->served_count[cls] = lockstep.served[cls][l];
+        out->total_wait_time[cls] = lockstep.total_wait[cls][l];
+        out->max_wait_time[cls] = lockstep.max_wait[cls][l];
+        if (out->served_count[cls] > 0) {
+            out->avg_wait_time[cls] = out->total_wait_time[cls] / out->served_count[cls];
+        }
+        for (int k = 0; k < WAIT_HIST_BINS; k++) {
+            out->wait_histogram[cls][k] = lockstep.histogram[cls][k][l];
+        }
+    }
+    out->business_served[0] = out->served_count[0] + out->served_count[1];
+    out->business_wait_time[0] = out->total_wait_time[0] + out->total_wait_time[1];
+    for (int i = 0; i < lockstep.customer_count; i++) {
+        if (lockstep.arrival[i][l] <= now) {
+            out->arrived_count[lockstep.type[i][l]]++;
+        }
+    }
+    for (int w = 0; w < MAX_WINDOWS; w++) {
+        double used = lockstep.busy_time[w][l] + lockstep.idle_time[w][l];
+        if (lockstep.open[w][l] != 0) {
+            out->window_utilization[w] = used > 0 ? lockstep.busy_time[w][l] / used * 100 : 0;
+            out->window_idle_rate[w] = 100 - out->window_utilization[w];
+        }
+    }
+    out->max_waiting = lockstep.peak_waiting[l];
+    out->total_served = out->served_count[0] + out->served_count[1];
+    if (now > 0) {
+        out->throughput = (out->total_served / now) * 60;
+    }
+}
+
+bool same_statistics(const Statistics* a, const Statistics* b) {
+    for (int cls = 0; cls < 2; cls++) {
+        if (a->served_count[cls] != b->served_count[cls] ||
+            a->arrived_count[cls] != b->arrived_count[cls] ||
+            fabs(a->avg_wait_time[cls] - b->avg_wait_time[cls]) > TRACE_TIME_TOLERANCE ||
+            fabs(a->max_wait_time[cls] - b->max_wait_time[cls]) > TRACE_TIME_TOLERANCE ||
+            memcmp(a->wait_histogram[cls], b->wait_histogram[cls], sizeof(a->wait_histogram[cls])) != 0) {
+            return false;
+        }
+    }
+    for (int w = 0; w < MAX_WINDOWS; w++) {
+        if (fabs(a->window_utilization[w] - b->window_utilization[w]) > 1e-6) return false;
+    }
+    return a->max_waiting == b->max_waiting && fabs(a->throughput - b->throughput) <= 1e-6;
+}
+
+void lockstep_mode() {
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    bool original_print_events = print_events;
+    const int count = 300, batches = 250, replications = batches * LOCKSTEP_LANES;
+    const char* names[] = {"е", "е", "жര"};
+    Statistics* scalar_stats = (Statistics*)malloc(sizeof(Statistics) * replications);
     
-    // 3: жരģ
-    printf("\n3. жരģͲԣ\n");
-    for (int i = 0; i < 40; i++) printf("-");
     printf("\n");
+    print_separator(50, '*');
+    printf("棨%d ͨ\n", LOCKSTEP_LANES);
+    print_separator(50, '*');
+    printf("ֶԱģ͸ظ %d Σÿ %d ͻ\n", replications, count);
+    printf("\n%-14s %-12s %-12s %-8s %-10s %-10s\n", "ģ", "()", "()", "", "һ", "ƽȴ");
+    printf("%-14s %-12s %-12s %-8s\n", "", "()", "()", "");
     
-    params = original_params; // ָԭʼ
+    log_events = false;
+    print_events = false;
+    for (int model = 0; model < 3; model++) {
+        params = original_params;
+        params.business_types = 1;
+        params.balk_threshold = 0;
+        params.mean_patience = 0;
+        if (model < 2) {
+            params.initial_windows = params.max_windows = params.min_windows = 1;
+            params.priority_ratio = model == 0 ? 0.0 : 0.7;
+            params.open_threshold = 10;
+            params.close_threshold = 5;
+        }
+        params.customer_count = count;
+        
+        clock_t begin = clock();
+        for (int r = 0; r < replications; r++) {
+            run_replication(count, 5000 + r);
+            scalar_stats[r] = stats;
+        }
+        double scalar_seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        
+        // 治ֵֻ֧
+        if (!lockstep_supported()) {
+            double scalar_wait = 0;
+            for (int r = 0; r < replications; r++) {
+                scalar_wait += scalar_stats[r].total_served > 0 ?
+                    (scalar_stats[r].total_wait_time[0] + scalar_stats[r].total_wait_time[1]) /
+                    scalar_stats[r].total_served : 0;
+            }
+            printf("%-14s %-12.3f %-12s %-8s %-10s %-10.2f\n", names[model], scalar_seconds,
+                   "-", "-", "-", scalar_wait / replications);
+            printf("%-14s ǰãģ//ڼܵȣ治֧֣\n", "");
+            continue;
+        }
+        
+        // ʱͻɣԱȽ汾
+        begin = clock();
+        for (int r = 0; r < replications; r++) {
+            next_customer_id = 1;
+            generate_customers_random(count, 5000 + r);
+        }
+        double generate_seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        
+        int matched = 0;
+        double wait_sum = 0, load_seconds = 0;
+        begin = clock();
+        for (int b = 0; b < batches; b++) {
+            int seeds[LOCKSTEP_LANES];
+            for (int l = 0; l < LOCKSTEP_LANES; l++) seeds[l] = 5000 + b * LOCKSTEP_LANES + l;
+            clock_t load_begin = clock();
+            lockstep_load(seeds);
+            load_seconds += (double)(clock() - load_begin) / CLOCKS_PER_SEC;
+            run_lockstep();
+            for (int l = 0; l < LOCKSTEP_LANES; l++) {
+                Statistics lane;
+                lockstep_statistics(l, &lane);
+                matched += same_statistics(&lane, &scalar_stats[b * LOCKSTEP_LANES + l]);
+                wait_sum += lane.total_served > 0 ?
+                    (lane.total_wait_time[0] + lane.total_wait_time[1]) / lane.total_served : 0;
+            }
+        }
+        double lockstep_seconds = (double)(clock() - begin) / CLOCKS_PER_SEC;
+        
+        double scalar_engine = scalar_seconds - generate_seconds;
+        double lockstep_engine = lockstep_seconds - load_seconds;
+        printf("%-14s %-12.3f %-12.3f %-8.1f %d/%-6d %-10.2f\n", names[model], scalar_seconds,
+               lockstep_seconds, lockstep_seconds > 0 ? scalar_seconds / lockstep_seconds : 0.0,
+               matched, replications, wait_sum / replications);
+        printf("%-14s %-12.3f %-12.3f %-8.1f\n", "", scalar_engine, lockstep_engine,
+               lockstep_engine > 0 ? scalar_engine / lockstep_engine : 0.0);
+    }
+    free(scalar_stats);
+    
+    params = original_params;
     log_events = original_log_events;
+    print_events = original_print_events;
+}
+
+// ==================== ο棨汾޸ģ ====================
+// 汾 run_simulation() ʵ֣¼¼켣
+// УŻǷı˷ԭĸֱ߽Ϊ
+// ͬһʱ̵ĺͻʱ䲻1ӵ¼Իᴦȣ
+typedef struct {
+    bool is_open;
+    bool is_busy;
+    double busy_start;
+    int customer_index;
+} RefWindow;
+
+typedef struct {
+    int items[MAX_CUSTOMERS];
+    int head;
+    int tail;
+} RefQueue;
+
+static RefWindow ref_windows[MAX_WINDOWS];
+static RefQueue ref_priority_queue;
+static RefQueue ref_normal_queue;
+
+int ref_queue_size(RefQueue* q) {
+    return q->tail - q->head;
+}
+
+int ref_next_customer(const SimulationParams* p) {
+    bool has_priority = ref_queue_size(&ref_priority_queue) > 0;
+    bool has_normal = ref_queue_size(&ref_normal_queue) > 0;
     
-    generate_customers_random(30, 1001);
-    current_time = 0;
-    init_windows(); // ³ʼ
-    run_simulation();
-    calculate_statistics();
+    if (has_priority && has_normal) {
+        if ((rand() % 100) < (int)(p->priority_ratio * 100)) {
+            return ref_priority_queue.items[ref_priority_queue.head++];
+        }
+        return ref_normal_queue.items[ref_normal_queue.head++];
+    }
+    if (has_priority) return ref_priority_queue.items[ref_priority_queue.head++];
+    if (has_normal) return ref_normal_queue.items[ref_normal_queue.head++];
+    return -1;
+}
+
+void ref_assign(const Customer* input, int window_id, int index, double t, EventTrace* trace) {
+    ref_windows[window_id].is_busy = true;
+    ref_windows[window_id].busy_start = t;
+    ref_windows[window_id].customer_index = index;
+    trace_append(trace, t, EVENT_START, input[index].id, window_id);
+}
+
+void ref_adjust(const SimulationParams* p, int* active, double t, EventTrace* trace) {
+    int total = ref_queue_size(&ref_priority_queue) + ref_queue_size(&ref_normal_queue);
     
-    double multi_multi_avg_wait = (stats.avg_wait_time[0] * stats.served_count[0] + 
-                                  stats.avg_wait_time[1] * stats.served_count[1]) / 
-                                  (stats.served_count[0] + stats.served_count[1]);
-    printf("ͨͻƽȴ: %.2f\n", stats.avg_wait_time[0]);
-    printf("ȿͻƽȴ: %.2f\n", stats.avg_wait_time[1]);
-    printf("Ȩƽȴ: %.2f\n", multi_multi_avg_wait);
-    printf(": %.2fͻ/Сʱ\n", stats.throughput);
+    if (total > p->open_threshold) {
+        for (int i = 0; i < p->max_windows; i++) {
+            if (!ref_windows[i].is_open) {
+                if (*active < p->max_windows) {
+                    ref_windows[i].is_open = true;
+                    (*active)++;
+                    trace_append(trace, t, EVENT_OPEN, -1, i);
+                }
+                break;
+            }
+        }
+    } else if (total < p->close_threshold) {
+        for (int i = 0; i < p->max_windows; i++) {
+            if (ref_windows[i].is_open && !ref_windows[i].is_busy) {
+                if (*active > p->min_windows) {
+                    ref_windows[i].is_open = false;
+                    (*active)--;
+                    trace_append(trace, t, EVENT_CLOSE, -1, i);
+                }
+                break;
+            }
+        }
+    }
+}
+
+void reference_simulation(const Customer* input, int count, const SimulationParams* p,
+                          EventTrace* trace) {
+    double t = 0;
+    int active = p->initial_windows;
     
-    printf("\nģͶԱܽ᣺\n");
-    printf("- еڣ򵥹ƽЧͣƽȴ: %.2fӣ\n", single_avg_wait);
-    printf("- еڣȿͻãͨͻܵȴʱ䳤Ȩƽ: %.2fӣ\n", multi_single_avg_wait);
-    printf("- жരڣۺãԴʸߣȨƽ: %.2fӣ\n", multi_multi_avg_wait);
+    for (int i = 0; i < MAX_WINDOWS; i++) {
+        ref_windows[i].is_open = (i < p->initial_windows);
+        ref_windows[i].is_busy = false;
+        ref_windows[i].busy_start = 0;
+        ref_windows[i].customer_index = -1;
+    }
+    ref_priority_queue.head = ref_priority_queue.tail = 0;
+    ref_normal_queue.head = ref_normal_queue.tail = 0;
+    trace->count = 0;
+    trace->digest = DIGEST_OFFSET_BASIS;
+    
+    while (t < p->simulation_time) {
+        double next_time = p->simulation_time + 1;
+        int next_type = -1;
+        int next_window = -1;
+        int next_index = -1;
+        
+        for (int i = 0; i < count; i++) {
+            if (input[i].arrival_time > t && input[i].arrival_time < next_time) {
+                next_time = input[i].arrival_time;
+                next_type = 0;
+                next_index = i;
+            }
+        }
+        for (int i = 0; i < MAX_WINDOWS; i++) {
+            if (ref_windows[i].is_busy) {
+                double finish = ref_windows[i].busy_start +
+                                input[ref_windows[i].customer_index].service_time;
+                if (finish > t && finish < next_time) {
+                    next_time = finish;
+                    next_type = 1;
+                    next_window = i;
+                }
+            }
+        }
+        if (next_type == -1) break;
+        
+        t = next_time;
+        if (next_type == 0) {
+            trace_append(trace, t, EVENT_ARRIVAL, input[next_index].id, -1);
+            if (input[next_index].type == 1) {
+                ref_priority_queue.items[ref_priority_queue.tail++] = next_index;
+            } else {
+                ref_normal_queue.items[ref_normal_queue.tail++] = next_index;
+            }
+            for (int i = 0; i < MAX_WINDOWS; i++) {
+                if (ref_windows[i].is_open && !ref_windows[i].is_busy) {
+                    int index = ref_next_customer(p);
+                    if (index != -1) ref_assign(input, i, index, t, trace);
+                    break;
+                }
+            }
+        } else {
+            int finished = ref_windows[next_window].customer_index;
+            ref_windows[next_window].is_busy = false;
+            trace_append(trace, t, EVENT_FINISH, input[finished].id, next_window);
+            int index = ref_next_customer(p);
+            if (index != -1) ref_assign(input, next_window, index, t, trace);
+        }
+        ref_adjust(p, &active, t, trace);
+    }
+}
+
+// ==================== һУ麯 ====================
+static EventTrace reference_trace;
+static EventTrace engine_trace;
+static Customer scenario_customers[MAX_CUSTOMERS];
+
+// ȶ켣0-ȫһ£1-ʱݲһ£2-ַ磨*diverge_atΪ׸¼±꣩
+int compare_traces(const EventTrace* a, const EventTrace* b, int* diverge_at) {
+    *diverge_at = -1;
+    if (a->count == b->count && a->digest == b->digest) return 0;
+    
+    int n = a->count < b->count ? a->count : b->count;
+    if (n > MAX_TRACE_EVENTS) n = MAX_TRACE_EVENTS;
+    for (int i = 0; i < n; i++) {
+        const EventRecord* x = &a->events[i];
+        const EventRecord* y = &b->events[i];
+        double scale = fabs(x->time) > 1.0 ? fabs(x->time) : 1.0;
+        if (x->type != y->type || x->customer_id != y->customer_id ||
+            x->window_id != y->window_id ||
+            fabs(x->time - y->time) > TRACE_TIME_TOLERANCE * scale) {
+            *diverge_at = i;
+            return 2;
+        }
+    }
+    if (a->count != b->count) {
+        *diverge_at = n;
+        return 2;
+    }
+    return 1;
+}
+
+void print_trace_event(const char* label, const EventTrace* trace, int index) {
+    if (index < trace->count && index < MAX_TRACE_EVENTS) {
+        const EventRecord* e = &trace->events[index];
+        printf("  %s: ʱ %.10f, %s, ͻ %d,  %d\n",
+               label, e->time, event_type_name(e->type), e->customer_id, e->window_id);
+    } else {
+        printf("  %s: (켣ѽ %d ¼)\n", label, trace->count);
+    }
+}
+
+#define SCENARIO_MAX_WINDOWS (MAX_WINDOWS < 20 ? MAX_WINDOWS : 20)
+
+// һУ鳡Ĳÿ101ʹͻĳ켣
+void random_scenario_params(int scenario, SimulationParams* p, int* count) {
+    p->initial_windows = 1 + rand() % SCENARIO_MAX_WINDOWS;
+    p->max_windows = p->initial_windows + rand() % (SCENARIO_MAX_WINDOWS - p->initial_windows + 1);
+    p->min_windows = 1 + rand() % p->initial_windows;
+    p->open_threshold = 1 + rand() % 10;
+    p->close_threshold = rand() % (p->open_threshold + 1);
+    p->priority_ratio = (rand() % 101) / 100.0;
+    p->business_types = 1; // οֻеһҵ࣬ҿͻʧ
+    p->balk_threshold = 0;
+    p->mean_patience = 0;
+    p->arrival_rate = 2.0;
+    p->service_rate = 3.0;
+    
+    if (scenario % 10 == 9) {
+        p->simulation_time = 1440;
+        *count = MAX_CUSTOMERS;
+    } else {
+        p->simulation_time = 30 + rand() % 451;
+        *count = 1 + rand() % 200;
+    }
+    p->customer_count = *count;
+}
+
+// ڴϷֱвο뵱ǰ棬׸¼
+int verify_engine_consistency(int scenario_count, int base_seed) {
+    SimulationParams original_params = params;
+    bool original_log_events = log_events;
+    bool original_print_events = print_events;
+    int identical = 0, tolerant = 0, diverged = 0;
+    long total_events = 0;
+    
+    log_events = false;
+    print_events = false;
+    
+    for (int s = 0; s < scenario_count; s++) {
+        int count;
+        srand(base_seed + s);
+        random_scenario_params(s, &params, &count);
+        int customer_seed = rand();
+        int run_seed = rand();
+        
+        next_customer_id = 1;
+        generate_customers_random(count, customer_seed);
+        memcpy(scenario_customers, customers, sizeof(Customer) * params.customer_count);
+        
+        srand(run_seed);
+        reference_simulation(scenario_customers, params.customer_count, &params, &reference_trace);
+        
+        srand(run_seed);
+        event_trace = &engine_trace;
+        current_time = 0;
+        run_simulation();
+        event_trace = NULL;
+        free_all_queues();
+        memcpy(customers, scenario_customers, sizeof(Customer) * params.customer_count);
+        
+        total_events += reference_trace.count;
+        int diverge_at;
+        int result = compare_traces(&reference_trace, &engine_trace, &diverge_at);
+        if (result == 0) {
+            identical++;
+        } else if (result == 1) {
+            tolerant++;
+        } else {
+            diverged++;
+            if (diverged == 1) {
+                printf(" %d ( %d) ڵ %d ¼ַ磺\n", s, base_seed + s, diverge_at);
+                printf("   %d/%d/%d, ֵ %d/%d, ȱ %.2f, ͻ %d, ʱ %d\n",
+                       params.initial_windows, params.min_windows, params.max_windows,
+                       params.open_threshold, params.close_threshold, params.priority_ratio,
+                       params.customer_count, params.simulation_time);
+                print_trace_event("ο", &reference_trace, diverge_at);
+                print_trace_event("ǰ", &engine_trace, diverge_at);
+            }
+        }
+    }
+    
+    params = original_params;
+    log_events = original_log_events;
+    print_events = original_print_events;
+    
+    printf("У鳡: %d, ¼: %ld\n", scenario_count, total_events);
+    printf("ȫһ: %d, ݲһ: %d, ַ: %d\n", identical, tolerant, diverged);
+    return diverged;
+}
+
+void consistency_check_mode() {
+    int scenario_count, seed;
+    
+    printf("\n");
+    print_separator(50, '*');
+    printf("һУ飨ο vs ǰ棩\n");
+    print_separator(50, '*');
+    
+    printf("У鳡 (1000-5000): ");
+    scanf("%d", &scenario_count);
+    printf("ʼ (): ");
+    scanf("%d", &seed);
+    if (scenario_count < 1) scenario_count = 1;
+    
+    int diverged = verify_engine_consistency(scenario_count, seed);
+    printf(diverged == 0 ? "Уͨ\n" : "Уʧ\n");
 }
 
 // ====================  ====================
@@ -811,8 +4833,17 @@ int main() {
     printf("1. ʾģʽʹԤ\n");
     printf("2. Զģʽ\n");
     printf("3. ģͶԱȲ\n");
-    printf("4. ˳\n");
-    printf("ѡ (1-4): ");
+    printf("4. һУ\n");
+    printf("5. ༼ܴʾ\n");
+    printf("6. ݶȹ\n");
+    printf("7. ϡ¼ʹ\n");
+    printf("8. ֲ\n");
+    printf("9. վŶ\n");
+    printf("10. ѹ׼\n");
+    printf("11. \n");
+    printf("12. \n");
+    printf("0. ˳\n");
+    printf("ѡ (0-12): ");
     scanf("%d", &main_choice);
     
     // 뻺
@@ -863,7 +4894,43 @@ int main() {
             model_comparison();
             break;
             
-        case 4: // ˳
+        case 4: // һУ
+            consistency_check_mode();
+            break;
+            
+        case 5: // ༼ܴʾ
+            skill_demo_mode();
+            break;
+            
+        case 6: // ݶȹ
+            gradient_mode();
+            break;
+            
+        case 7: // ϡ¼
+            rare_event_mode();
+            break;
+            
+        case 8: // ֲ
+            distribution_mode();
+            break;
+            
+        case 9: // վ
+            network_mode();
+            break;
+            
+        case 10: // ѹ׼
+            stress_benchmark_mode();
+            break;
+            
+        case 11: // 
+            lockstep_mode();
+            break;
+            
+        case 12: // 
+            result_cache_mode();
+            break;
+            
+        case 0: // ˳
             printf("лʹãټ\n");
             break;
             
@@ -879,8 +4946,10 @@ int main() {
     }
     
     // ͷŶڴ
-    free_queue_memory(&priority_queue);
-    free_queue_memory(&normal_queue);
+    free_all_queues();
+    free_workload_model(cached_workload_model);
+    free_event_heap(&event_heap);
+    close_result_cache(result_cache);
     
     printf("\nEnter˳...");
     getchar(); // ȴûEnter